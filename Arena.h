@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+// Monotonic memory for a tree: nodes and polygon vertex storage are carved out of big blocks
+// and never freed one by one. Releasing the arena frees everything at once, without visiting
+// the nodes, so objects living in it are not destroyed (they must only own arena memory).
+// Each resource is used by one thread at a time; parallel builds take one per task, which
+// also keeps the nodes of a subtree together.
+class Arena {
+private:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>> resources;
+
+public:
+    Arena() { createResource(); }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // Resource for the sequential operations on the tree
+    std::pmr::memory_resource *getResource() { return resources.front().get(); }
+
+    // New independent resource, owned by the arena (thread safe)
+    std::pmr::memory_resource *createResource() {
+        std::lock_guard<std::mutex> lock(mutex);
+        resources.push_back(std::make_unique<std::pmr::monotonic_buffer_resource>(BLOCK_SIZE));
+        return resources.back().get();
+    }
+
+    // Free all the memory handed out so far
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        resources.resize(1);
+        resources.front()->release();
+    }
+
+    // Construct an object in memory from 'resource'. It is never destroyed: release the arena instead
+    template <typename T, typename... Args>
+    static T *create(std::pmr::memory_resource *resource, Args &&... args) {
+        void *memory = resource->allocate(sizeof(T), alignof(T));
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+};
+
+#endif // ARENA_H
@@ -0,0 +1,123 @@
+#include "BSPQueryExecutor.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+LatencyStats LatencyStats::fromSamples(std::vector<double> samples) {
+    LatencyStats stats;
+    stats.count = samples.size();
+    if (samples.empty()) {
+        return stats;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+        auto rank = static_cast<size_t>(std::ceil(p * static_cast<double>(samples.size())));
+        return samples[std::max<size_t>(rank, 1) - 1];
+    };
+    stats.p50 = percentile(0.50);
+    stats.p90 = percentile(0.90);
+    stats.p99 = percentile(0.99);
+    stats.max = samples.back();
+    return stats;
+}
+
+BSPQueryExecutor::BSPQueryExecutor(const BSPTree &tree, size_t threads, size_t segmentsGrain, size_t pointsGrain)
+        : tree(tree), pool(threads), segmentsGrain(std::max<size_t>(segmentsGrain, 1)),
+          pointsGrain(std::max<size_t>(pointsGrain, 1)), batchesCount(0) {
+    history.reserve(HISTORY_SIZE);
+}
+
+template <typename Query>
+BatchReport BSPQueryExecutor::run(size_t count, size_t grainSize, const Query &query) {
+    auto start = Clock::now();
+    // one slot per chunk, written by whichever worker runs it
+    std::vector<double> chunkSeconds((count + grainSize - 1) / grainSize);
+    std::vector<QueryCounters> chunkCounters(QUERY_COUNTERS_ENABLED ? chunkSeconds.size() : 0);
+    parallelFor(pool, 0, count, grainSize, [&](size_t begin, size_t end) {
+        auto chunkStart = Clock::now();
+        QueryCounters countersBefore = threadQueryCounters();
+        query(begin, end);
+        chunkSeconds[begin / grainSize] = secondsSince(chunkStart);
+        if constexpr (QUERY_COUNTERS_ENABLED) {
+            chunkCounters[begin / grainSize] = threadQueryCounters() - countersBefore;
+        }
+    });
+
+    BatchReport report;
+    for (const auto &counters: chunkCounters) {
+        report.counters += counters;
+    }
+    report.queries = count;
+    report.seconds = secondsSince(start);
+    report.chunks = LatencyStats::fromSamples(std::move(chunkSeconds));
+
+    std::lock_guard<std::mutex> lock(historyMutex);
+    if (history.size() < HISTORY_SIZE) {
+        history.push_back(report.seconds);
+    } else {
+        history[batchesCount % HISTORY_SIZE] = report.seconds;
+    }
+    batchesCount++;
+    return report;
+}
+
+BatchReport BSPQueryExecutor::detectCollisions(const LineSegment *segments, size_t count, Collision *hits) {
+    // one segment at a time: the packets of detectCoherentCollisions only pay off on bundles
+    return run(count, segmentsGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            hits[i] = tree.detectCollision(segments[i]);
+        }
+    });
+}
+
+BatchReport BSPQueryExecutor::detectCollisions(const std::vector<LineSegment> &segments, std::vector<Collision> &hits) {
+    hits.resize(segments.size());
+    return detectCollisions(segments.data(), segments.size(), hits.data());
+}
+
+BatchReport BSPQueryExecutor::sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits) {
+    return run(count, segmentsGrain, [&](size_t begin, size_t end) {
+        tree.sweepSpheres(sweeps + begin, end - begin, hits + begin);
+    });
+}
+
+BatchReport BSPQueryExecutor::sweepSpheres(const std::vector<SphereSweep> &sweeps, std::vector<SweepHit> &hits) {
+    hits.resize(sweeps.size());
+    return sweepSpheres(sweeps.data(), sweeps.size(), hits.data());
+}
+
+BatchReport BSPQueryExecutor::classifyPoints(const Point3D *points, size_t count, PointLocation *locations) {
+    // checked here so that the error is not thrown by every chunk
+    if (!tree.isSolid()) {
+        throw std::runtime_error("classifyPoints needs a tree built by buildSolid");
+    }
+    return run(count, pointsGrain, [&](size_t begin, size_t end) {
+        tree.classifyPoints(points + begin, end - begin, locations + begin);
+    });
+}
+
+BatchReport BSPQueryExecutor::classifyPoints(const std::vector<Point3D> &points, std::vector<PointLocation> &locations) {
+    locations.resize(points.size());
+    return classifyPoints(points.data(), points.size(), locations.data());
+}
+
+LatencyStats BSPQueryExecutor::getBatchLatencies() const {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    return LatencyStats::fromSamples(history);
+}
+
+size_t BSPQueryExecutor::getBatchesCount() const {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    return batchesCount;
+}
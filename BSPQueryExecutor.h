@@ -0,0 +1,82 @@
+#ifndef BSP_QUERY_EXECUTOR_H
+#define BSP_QUERY_EXECUTOR_H
+
+#include "DataType.h"
+#include "Point.h"
+#include "Line.h"
+#include "BSPTree.h"
+#include "ThreadPool.h"
+#include "QueryCounters.h"
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Latency distribution of a set of samples, in seconds (nearest rank percentiles)
+struct LatencyStats {
+    size_t count = 0;
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+    static LatencyStats fromSamples(std::vector<double> samples);
+};
+
+// What a batch took: the whole batch, and its chunks (the unit of work of a worker)
+struct BatchReport {
+    size_t queries = 0;
+    double seconds = 0;
+    LatencyStats chunks;
+    QueryCounters counters;     // of all the workers, zero without BSP_ENABLE_COUNTERS
+
+    double queriesPerSecond() const { return seconds > 0 ? static_cast<double>(queries) / seconds : 0; }
+};
+
+// Runs large batches of queries on a read-only BSPTree with a fixed pool of worker threads.
+// A batch is cut in chunks that the workers take with work stealing (ThreadPool). A chunk of
+// segments runs BSPTree::detectCollision one segment at a time, a chunk of points the blocked
+// BSPTree::classifyPoints, and both write their results straight into the caller's output array,
+// at the index of each query.
+// The tree must not change while a batch runs. Batches may be submitted from several threads.
+class BSPQueryExecutor {
+private:
+    const BSPTree &tree;
+    ThreadPool pool;
+    size_t segmentsGrain;
+    size_t pointsGrain;
+
+    // Latencies of the last HISTORY_SIZE batches, as a ring
+    static constexpr size_t HISTORY_SIZE = 1024;
+    mutable std::mutex historyMutex;
+    std::vector<double> history;
+    size_t batchesCount;
+
+    template <typename Query>
+    BatchReport run(size_t count, size_t grainSize, const Query &query);
+
+public:
+    // 'threads' counts the threads submitting batches, which work on them as well
+    explicit BSPQueryExecutor(const BSPTree &tree, size_t threads = std::thread::hardware_concurrency(),
+                              size_t segmentsGrain = 1024, size_t pointsGrain = 4096);
+
+    BSPQueryExecutor(const BSPQueryExecutor &) = delete;
+    BSPQueryExecutor &operator=(const BSPQueryExecutor &) = delete;
+
+    size_t getThreadsCount() const { return pool.getThreadsCount(); }
+
+    // hits[i] is the first collision of segments[i], as BSPTree::detectCollision
+    BatchReport detectCollisions(const LineSegment *segments, size_t count, Collision *hits);
+    BatchReport detectCollisions(const std::vector<LineSegment> &segments, std::vector<Collision> &hits);
+
+    // hits[i] is the first contact of sweeps[i], as BSPTree::sweepSpheres (chunks of segmentsGrain)
+    BatchReport sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits);
+    BatchReport sweepSpheres(const std::vector<SphereSweep> &sweeps, std::vector<SweepHit> &hits);
+
+    // locations[i] is the location of points[i], as BSPTree::classifyPoints (the tree must be solid)
+    BatchReport classifyPoints(const Point3D *points, size_t count, PointLocation *locations);
+    BatchReport classifyPoints(const std::vector<Point3D> &points, std::vector<PointLocation> &locations);
+
+    // Latencies of the recent batches, and how many batches ran in total
+    LatencyStats getBatchLatencies() const;
+    size_t getBatchesCount() const;
+};
+
+#endif // BSP_QUERY_EXECUTOR_H
@@ -2,112 +2,1491 @@
 // Created by Joaquin on 5/09/24.
 //
 #include "BSPTree.h"
-#include <stack>
+#include "Classification.h"
+#include "QueryCounters.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <unordered_set>
+#include <stdexcept>
 
-void BSPNode::insert(const Polygon &polygon) {
+void BSPNode::insert(const Polygon &polygon, std::pmr::vector<BSPNode *> *placed) {
+    // slivers left by splits have no plane to partition with
+    if (polygon.isDegenerate()) {
+        return;
+    }
     // determine on which side of the plane the current polygon is
     auto relation = polygon.relationWithPlane(partition);
     switch (relation) {
         case COINCIDENT:
             // insert in this node
             polygons.push_back(polygon);
+            for (const auto &vertex: polygon.getVertices()) {
+                bounds.extend(vertex);
+            }
+            if (placed != nullptr) {
+                placed->push_back(this);
+            }
             break;
         case IN_FRONT:
             // insert recursively
             if (front == nullptr) {
-                front = new BSPNode(polygon.getPlane());
+                front = Arena::create<BSPNode>(getResource(), polygon.getPlane(), getResource());
             }
             front->setParent(this);
-            front->insert(polygon);
+            front->insert(polygon, placed);
             break;
         case BEHIND:
             if (back == nullptr) {
-                back = new BSPNode(polygon.getPlane());
+                back = Arena::create<BSPNode>(getResource(), polygon.getPlane(), getResource());
             }
             back->setParent(this);
-            back->insert(polygon);
+            back->insert(polygon, placed);
             break;
         case SPLIT:
-            auto [frontPart, backPart] = polygon.split(partition);
-            if (front == nullptr) {
-                front = new BSPNode(frontPart.getPlane());
+            SplitBuffer parts;
+            parts.split(polygon, partition);
+            if (!parts.front.isDegenerate()) {
+                if (front == nullptr) {
+                    front = Arena::create<BSPNode>(getResource(), parts.front.getPlane(), getResource());
+                }
+                front->setParent(this);
+                front->insert(parts.front, placed);
             }
-            front->setParent(this);
-            front->insert(frontPart);
-            if (back == nullptr) {
-                back = new BSPNode(backPart.getPlane());
+            if (!parts.back.isDegenerate()) {
+                if (back == nullptr) {
+                    back = Arena::create<BSPNode>(getResource(), parts.back.getPlane(), getResource());
+                }
+                back->setParent(this);
+                back->insert(parts.back, placed);
             }
-            back->setParent(this);
-            back->insert(backPart);
             break;
     }
+    // grow by what reached the children, which may be less than the polygon: slivers are dropped
+    if (relation != COINCIDENT) {
+        if (front != nullptr) {
+            bounds.extend(front->bounds);
+        }
+        if (back != nullptr) {
+            bounds.extend(back->bounds);
+        }
+    }
+    updateCounts();
+}
+
+size_t BSPNode::removePolygons(PolygonId id) {
+    size_t before = polygons.size();
+    polygons.erase(std::remove_if(polygons.begin(), polygons.end(),
+                                  [id](const Polygon &polygon) { return polygon.getId() == id; }),
+                   polygons.end());
+    return before - polygons.size();
+}
+
+namespace {
+
+// Polygon::contains accepts points up to its tolerance away from the polygon, the bounds are
+// grown a bit more than that so that the slab test never rejects a hit
+constexpr double BOUNDS_MARGIN = 10 * CLASSIFY_EPSILON;
+
+bool segmentTouchesBounds(const BoundingBox &bounds, const Point3D &origin, const Vector3D &direction, NType tMin,
+                          NType tMax) {
+    const double o[3] = {origin.getX().getValue(), origin.getY().getValue(), origin.getZ().getValue()};
+    const double d[3] = {direction.getX().getValue(), direction.getY().getValue(), direction.getZ().getValue()};
+    return bounds.intersectsSegment(o, d, tMin.getValue(), tMax.getValue(), BOUNDS_MARGIN);
+}
+
+// A sphere sweep in raw doubles: the center is at origin + t * direction
+struct SphereTrace {
+    double origin[3];
+    double direction[3];
+    double radius;
+
+    void centerAt(double t, double center[3]) const {
+        for (int i = 0; i < 3; ++i) {
+            center[i] = origin[i] + direction[i] * t;
+        }
+    }
+};
+
+// State of a sphere sweep: the first contact found so far ('time' bounds the rest of the search),
+// and the polygons the sphere touches at the start, found by a first pass at t = 0
+struct SphereSweepState {
+    SphereTrace trace;
+    bool startPass = false;
+    std::vector<PolygonId> touched;
+    const Polygon *polygon = nullptr;
+    double time = 1;
+    double point[3] = {0, 0, 0};
+    double normal[3] = {0, 0, 0};
+
+    bool found(const Polygon &contactPolygon, double contactTime, const double contactPoint[3],
+               const double contactNormal[3]) {
+        polygon = &contactPolygon;
+        time = contactTime;
+        std::copy(contactPoint, contactPoint + 3, point);
+        std::copy(contactNormal, contactNormal + 3, normal);
+        return true;
+    }
+};
+
+double dot(const double a[3], const double b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Restrict [tMin, tMax] to where startDist + slope * t <= limit (empty when tMin > tMax)
+void clipToHalfSpace(double startDist, double slope, double limit, double &tMin, double &tMax) {
+    if (slope == 0) {
+        if (startDist > limit) {
+            tMin = std::numeric_limits<double>::infinity();
+        }
+        return;
+    }
+    double t = (limit - startDist) / slope;
+    if (slope > 0) {
+        tMax = std::min(tMax, t);
+    } else {
+        tMin = std::max(tMin, t);
+    }
+}
+
+// Smallest root of a t² + 2 b t + c = 0: when the distance from the center to a point (or a line)
+// comes down to the radius
+bool enteringRoot(double a, double b, double c, double &t) {
+    double discriminant = b * b - a * c;
+    if (a <= 0 || discriminant < 0) {
+        return false;
+    }
+    t = (-b - std::sqrt(discriminant)) / a;
+    return true;
+}
+
+// First contact in [tMin, tMax] of the sphere with a convex polygon, stored in 'state' when it is
+// before state.time. The distance from the center to the polygon is a convex function of t, so
+// the first contact is the face (the sphere reaching the plane with the contact point inside), or
+// else the first of the edges (cylinders) and vertices (spheres) around it.
+// A polygon the sphere already touches at tMin is a contact only if the sphere moves towards its
+// plane. The decision depends on the plane alone, so all the fragments of a split polygon agree
+bool sweepPolygon(const Polygon &polygon, SphereSweepState &state, double tMin, double tMax) {
+    const SphereTrace &trace = state.trace;
+    tMax = std::min(tMax, state.time);
+    if (tMin > tMax) {
+        return false;
+    }
+    const double radius = trace.radius;
+    const double *direction = trace.direction;
+    double start[3], center[3];
+    trace.centerAt(tMin, start);
+    Plane plane = polygon.getPlane();
+    const double *n = plane.getEquation();
+    double centerDist = dot(n, start) + n[3];
+    double side = centerDist >= 0 ? 1 : -1;
+    double slope = dot(n, direction);
+
+    Point3D closest = polygon.closestPoint(Point3D(start[0], start[1], start[2]));
+    const double closestPoint[3] = {closest.getX().getValue(), closest.getY().getValue(), closest.getZ().getValue()};
+    double away[3] = {start[0] - closestPoint[0], start[1] - closestPoint[1], start[2] - closestPoint[2]};
+    double distance = std::sqrt(dot(away, away));
+    if (distance <= radius) {
+        if (state.startPass && std::find(state.touched.begin(), state.touched.end(), polygon.getId()) ==
+                               state.touched.end()) {
+            state.touched.push_back(polygon.getId());
+        }
+        if (slope * side >= 0) {
+            return false;
+        }
+        double normal[3];
+        for (int i = 0; i < 3; ++i) {
+            normal[i] = distance > 0 ? away[i] / distance : n[i] * side;
+        }
+        return state.found(polygon, tMin, closestPoint, normal);
+    }
+    if (state.startPass) {
+        return false;
+    }
+
+    // the face: the center at 'radius' from the plane, on its side of it
+    if (slope * side < 0) {
+        double t = tMin + (side * radius - centerDist) / slope;
+        if (t >= tMin && t <= tMax) {
+            trace.centerAt(t, center);
+            const double point[3] = {center[0] - n[0] * side * radius, center[1] - n[1] * side * radius,
+                                     center[2] - n[2] * side * radius};
+            if (polygon.contains(Point3D(point[0], point[1], point[2]))) {
+                const double normal[3] = {n[0] * side, n[1] * side, n[2] * side};
+                return state.found(polygon, t, point, normal);
+            }
+        }
+    }
+
+    // the vertices and the edges, with t relative to tMin
+    bool hit = false;
+    const double *xyz = vertexData(polygon.getVertices().data());
+    size_t numVertices = polygon.getVertices().size();
+    double directionLength = dot(direction, direction);
+    for (size_t i = 0; i < numVertices; ++i) {
+        const double *a = xyz + 3 * i, *b = xyz + 3 * polygon.nextVertexIndex(i);
+        double edge[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        double m[3] = {start[0] - a[0], start[1] - a[1], start[2] - a[2]};
+        double edgeLength = dot(edge, edge), directionEdge = dot(direction, edge), mEdge = dot(m, edge);
+        double t;
+        if (enteringRoot(directionLength, dot(m, direction), dot(m, m) - radius * radius, t) && t >= 0 &&
+            tMin + t <= tMax) {
+            tMax = tMin + t;
+            trace.centerAt(tMax, center);
+            const double normal[3] = {(center[0] - a[0]) / radius, (center[1] - a[1]) / radius,
+                                      (center[2] - a[2]) / radius};
+            hit = state.found(polygon, tMax, a, normal);
+        }
+        // a motion parallel to the edge reaches one of its vertices first
+        double quadratic = edgeLength * directionLength - directionEdge * directionEdge;
+        if (quadratic > 1e-12 * edgeLength * directionLength &&
+            enteringRoot(quadratic, edgeLength * dot(m, direction) - mEdge * directionEdge,
+                         edgeLength * (dot(m, m) - radius * radius) - mEdge * mEdge, t) &&
+            t >= 0 && tMin + t <= tMax) {
+            double along = (mEdge + t * directionEdge) / edgeLength;
+            if (along >= 0 && along <= 1) {
+                tMax = tMin + t;
+                trace.centerAt(tMax, center);
+                const double point[3] = {a[0] + edge[0] * along, a[1] + edge[1] * along, a[2] + edge[2] * along};
+                const double normal[3] = {(center[0] - point[0]) / radius, (center[1] - point[1]) / radius,
+                                          (center[2] - point[2]) / radius};
+                hit = state.found(polygon, tMax, point, normal);
+            }
+        }
+    }
+    return hit;
+}
+
+// Descent of a sphere sweep: the partition of the node is thickened by the radius, a side is
+// visited for the part of [tMin, tMax] where the sphere reaches it, and the polygons of the node
+// (on the partition) while the sphere touches the plane. Near side first, so that an early contact
+// cuts the rest of the search short. Polygons touched at the start are skipped after the first pass
+void sweepNode(const BSPNode *node, SphereSweepState &state, double tMin, double tMax) {
+    const SphereTrace &trace = state.trace;
+    tMax = std::min(tMax, state.time);
+    if (tMin > tMax) {
+        return;
+    }
+    BSP_COUNT(nodesVisited, 1);
+    if (!node->getBounds().intersectsSegment(trace.origin, trace.direction, tMin, tMax,
+                                             trace.radius + BOUNDS_MARGIN)) {
+        return;
+    }
+    BSP_COUNT(planeTests, 1);
+    const double *plane = node->partition.getEquation();
+    double originDist = dot(plane, trace.origin) + plane[3];
+    double directionDist = dot(plane, trace.direction);
+    double reach = trace.radius + CLASSIFY_EPSILON;
+    double frontMin = tMin, frontMax = tMax, backMin = tMin, backMax = tMax;
+    clipToHalfSpace(-originDist, -directionDist, reach, frontMin, frontMax);
+    clipToHalfSpace(originDist, directionDist, reach, backMin, backMax);
+
+    bool startInFront = originDist + directionDist * tMin >= 0;
+    const BSPNode *nearSide = startInFront ? node->front : node->back;
+    const BSPNode *farSide = startInFront ? node->back : node->front;
+    if (nearSide != nullptr) {
+        sweepNode(nearSide, state, startInFront ? frontMin : backMin, startInFront ? frontMax : backMax);
+    }
+    double nodeMin = std::max(frontMin, backMin), nodeMax = std::min(frontMax, backMax);
+    for (const auto &polygon: node->polygons) {
+        if (nodeMin > std::min(nodeMax, state.time)) {
+            break;
+        }
+        if (!state.startPass && std::find(state.touched.begin(), state.touched.end(), polygon.getId()) !=
+                                state.touched.end()) {
+            continue;
+        }
+        BSP_COUNT(polygonTests, 1);
+        sweepPolygon(polygon, state, nodeMin, nodeMax);
+    }
+    if (farSide != nullptr) {
+        sweepNode(farSide, state, startInFront ? backMin : frontMin, startInFront ? backMax : frontMax);
+    }
+}
+
+// Distance from the point to the polygon, and the point of the polygon where it is reached
+double polygonDistance(const Polygon &polygon, const Point3D &point, Point3D &closest) {
+    closest = polygon.closestPoint(point);
+    double x = (point.getX() - closest.getX()).getValue(), y = (point.getY() - closest.getY()).getValue(),
+           z = (point.getZ() - closest.getZ()).getValue();
+    return std::sqrt(x * x + y * y + z * z);
+}
+
+// Best polygon of a nearest polygon query so far, 'distance' bounds the rest of the search
+struct NearestState {
+    Point3D point;
+    double xyz[3];
+    const Polygon *polygon = nullptr;
+    double distance;
+    Point3D closest;
+};
+
+// Side of the point first; the polygons of the node (on the partition) and the far side are at
+// least the distance to the partition away, up to the tolerance of the coplanar test
+void nearestNode(const BSPNode *node, NearestState &state) {
+    BSP_COUNT(nodesVisited, 1);
+    if (node->getBounds().distance(state.xyz) > state.distance) {
+        return;
+    }
+    BSP_COUNT(planeTests, 1);
+    const double *plane = node->partition.getEquation();
+    double planeDist = dot(plane, state.xyz) + plane[3];
+    const BSPNode *nearSide = planeDist >= 0 ? node->front : node->back;
+    const BSPNode *farSide = planeDist >= 0 ? node->back : node->front;
+    if (nearSide != nullptr) {
+        nearestNode(nearSide, state);
+    }
+    if (std::abs(planeDist) - CLASSIFY_EPSILON > state.distance) {
+        return;
+    }
+    for (const auto &polygon: node->polygons) {
+        BSP_COUNT(polygonTests, 1);
+        Point3D closest;
+        double distance = polygonDistance(polygon, state.point, closest);
+        if (distance < state.distance || (state.polygon == nullptr && distance <= state.distance)) {
+            state.polygon = &polygon;
+            state.distance = distance;
+            state.closest = closest;
+        }
+    }
+    if (farSide != nullptr) {
+        nearestNode(farSide, state);
+    }
+}
+
+// nearestNode with a fixed bound, collecting every polygon within it
+void radiusNode(const BSPNode *node, const Point3D &point, const double xyz[3], double radius,
+                std::vector<const Polygon *> &result) {
+    BSP_COUNT(nodesVisited, 1);
+    if (node->getBounds().distance(xyz) > radius) {
+        return;
+    }
+    BSP_COUNT(planeTests, 1);
+    const double *plane = node->partition.getEquation();
+    double planeDist = dot(plane, xyz) + plane[3];
+    const BSPNode *nearSide = planeDist >= 0 ? node->front : node->back;
+    const BSPNode *farSide = planeDist >= 0 ? node->back : node->front;
+    if (nearSide != nullptr) {
+        radiusNode(nearSide, point, xyz, radius, result);
+    }
+    if (std::abs(planeDist) - CLASSIFY_EPSILON > radius) {
+        return;
+    }
+    for (const auto &polygon: node->polygons) {
+        BSP_COUNT(polygonTests, 1);
+        Point3D closest;
+        if (polygonDistance(polygon, point, closest) <= radius) {
+            result.push_back(&polygon);
+        }
+    }
+    if (farSide != nullptr) {
+        radiusNode(farSide, point, xyz, radius, result);
+    }
+}
+
+} // namespace
+
+Collision BSPNode::detectCollision(const LineSegment &traceLine) const {
+    BSP_COUNT(queries, 1);
+    Collision hit;
+    auto origin = traceLine.getP1();
+    auto direction = Vector3D(traceLine.getP2() - origin);
+    traceSegment(origin, direction, 0, 1, hit);
+    return hit;
+}
+
+void BSPNode::detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const {
+    for (size_t i = 0; i < count; ++i) {
+        hits[i] = detectCollision(traceLines[i]);
+    }
+}
+
+void BSPNode::detectCoherentCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const {
+    BSP_COUNT(queries, count);
+    std::vector<SegmentTrace> traces(std::min(count, PACKET_SIZE));
+    std::vector<PacketEntry> packet;
+    for (size_t first = 0; first < count; first += PACKET_SIZE) {
+        size_t packetSize = std::min(count - first, PACKET_SIZE);
+        packet.clear();
+        BoundingBox packetBounds;
+        for (size_t i = 0; i < packetSize; ++i) {
+            auto &trace = traces[i];
+            const auto &traceLine = traceLines[first + i];
+            const Point3D ends[2] = {traceLine.getP1(), traceLine.getP2()};
+            const double *start = vertexData(ends), *end = vertexData(ends + 1);
+            for (int axis = 0; axis < 3; ++axis) {
+                trace.origin[axis] = start[axis];
+                trace.direction[axis] = end[axis] - start[axis];
+            }
+            trace.length = std::sqrt(dot(trace.direction, trace.direction));
+            packetBounds.extend(start);
+            packetBounds.extend(end);
+            hits[first + i] = Collision();
+            packet.push_back({static_cast<uint32_t>(i), 0, 1});
+        }
+        if (bounds.overlaps(packetBounds, BOUNDS_MARGIN)) {
+            traceSegments(traces.data(), hits + first, packet, 0, packetSize,
+                          packetBounds.clippedTo(bounds, BOUNDS_MARGIN));
+        }
+    }
+}
+
+bool BSPNode::traceSegment(const Point3D &origin, const Vector3D &direction, NType tMin, NType tMax, Collision &hit) const {
+    BSP_COUNT(nodesVisited, 1);
+    if (!segmentTouchesBounds(bounds, origin, direction, tMin, tMax)) {
+        return false;
+    }
+    BSP_COUNT(planeTests, 1);
+    // signed distances of both ends of the clipped segment
+    auto originDist = partition.distance(origin);
+    auto directionDist = partition.getNormal().dotProduct(direction);
+    auto startDist = originDist + directionDist * tMin;
+    auto endDist = originDist + directionDist * tMax;
+    bool startInFront = startDist >= 0;
+    bool endInFront = endDist >= 0;
+
+    // the segment does not cross the partition, only one side can be hit
+    if (startInFront == endInFront) {
+        BSPNode *side = startInFront ? front : back;
+        return side != nullptr && side->traceSegment(origin, direction, tMin, tMax, hit);
+    }
+
+    // the segment crosses the partition: near side, this node, far side
+    auto ratio = startDist.getValue() / (startDist.getValue() - endDist.getValue());
+    NType tSplit = tMin + (tMax - tMin) * std::min(std::max(ratio, 0.0), 1.0);
+    BSPNode *nearSide = startInFront ? front : back;
+    BSPNode *farSide = startInFront ? back : front;
+    if (nearSide != nullptr && nearSide->traceSegment(origin, direction, tMin, tSplit, hit)) {
+        return true;
+    }
+    Point3D point = Vector3D(origin) + direction * tSplit;
+    for (const auto &polygon: polygons) {
+        BSP_COUNT(polygonTests, 1);
+        if (polygon.contains(point)) {
+            hit.polygon = &polygon;
+            hit.distance = direction.mag() * tSplit;
+            hit.point = point;
+            return true;
+        }
+    }
+    return farSide != nullptr && farSide->traceSegment(origin, direction, tSplit, tMax, hit);
+}
+
+void BSPNode::traceSegments(const SegmentTrace *traces, Collision *hits, std::vector<PacketEntry> &packet,
+                            size_t first, size_t count, const BoundingBox &packetBounds) const {
+    BSP_COUNT(nodesVisited, count);
+    // The parts in [begin, end) go to 'child' unless their box misses its bounds: the packet is
+    // culled once per node. What the child gets is that box clipped to its bounds, where its hits are
+    auto walk = [&](const BSPNode *child, const BoundingBox &partsBounds, size_t begin, size_t end) {
+        if (child != nullptr && begin < end && child->bounds.overlaps(partsBounds, BOUNDS_MARGIN)) {
+            child->traceSegments(traces, hits, packet, begin, end - begin,
+                                 partsBounds.clippedTo(child->bounds, BOUNDS_MARGIN));
+        }
+    };
+
+    // a partition that leaves the whole packet box on one side sends the packet there as it is,
+    // without a hit here: one plane test for the packet. The segments may reach the other side
+    // outside the box, but there is nothing to hit there
+    const double *plane = partition.getEquation();
+    bool allInFront = packetBounds.minDistance(plane) > BOUNDS_MARGIN;
+    if (allInFront || packetBounds.maxDistance(plane) < -BOUNDS_MARGIN) {
+        BSP_COUNT(planeTests, 1);
+        walk(allInFront ? front : back, packetBounds, first, first + count);
+        return;
+    }
+    BSP_COUNT(planeTests, count);
+    // One pass over the packet on the raw plane equation sorts every entry into two regions
+    // appended to the packet. The near one holds the parts before the partition, those starting in
+    // front from its beginning and those starting behind from its end; the far one the parts after
+    // the partition of the crossing segments, in the same way
+    size_t nearBase = packet.size(), farBase = nearBase + count, farEnd = farBase + count;
+    packet.resize(farEnd);
+    size_t frontNear = nearBase, backNear = farBase, frontFar = farBase, backFar = farEnd;
+    BoundingBox frontNearBounds, backNearBounds, frontFarBounds, backFarBounds;
+    for (size_t i = first; i < first + count; ++i) {
+        PacketEntry entry = packet[i];
+        const auto &trace = traces[entry.trace];
+        double originDist = dot(plane, trace.origin) + plane[3];
+        double directionDist = dot(plane, trace.direction);
+        double startDist = originDist + directionDist * entry.tMin;
+        double endDist = originDist + directionDist * entry.tMax;
+        bool startInFront = startDist >= 0;
+        double start[3], end[3];
+        trace.pointAt(entry.tMin, start);
+        trace.pointAt(entry.tMax, end);
+        BoundingBox &nearBounds = startInFront ? frontNearBounds : backNearBounds;
+        nearBounds.extend(start);
+        if (startInFront == (endDist >= 0)) {
+            nearBounds.extend(end);
+            packet[startInFront ? frontNear++ : --backNear] = entry;
+            continue;
+        }
+        double ratio = startDist / (startDist - endDist);
+        double tSplit = entry.tMin + (entry.tMax - entry.tMin) * std::min(std::max(ratio, 0.0), 1.0);
+        double split[3];
+        trace.pointAt(tSplit, split);
+        BoundingBox &farBounds = startInFront ? frontFarBounds : backFarBounds;
+        nearBounds.extend(split);
+        farBounds.extend(split);
+        farBounds.extend(end);
+        packet[startInFront ? frontNear++ : --backNear] = {entry.trace, entry.tMin, tSplit};
+        packet[startInFront ? frontFar++ : --backFar] = {entry.trace, tSplit, entry.tMax};
+    }
+
+    // The polygons of this node for the far parts in [begin, end) whose segment has no hit yet:
+    // they are tested where the segment crosses the partition, the start of the far part. The
+    // normal of each polygon is computed once for all of them. The far parts still without a hit
+    // are kept at the beginning, the new end is returned
+    auto testPartition = [&](size_t begin, size_t end) {
+        for (const auto &polygon: polygons) {
+            if (begin == end) {
+                break;
+            }
+            // as Polygon::contains: degenerate polygons contain nothing
+            auto normal = polygon.getNormal();
+            auto normalMag = normal.mag();
+            if (normalMag == 0) {
+                continue;
+            }
+            normal /= normalMag;
+            for (size_t i = begin; i < end; ++i) {
+                const PacketEntry &entry = packet[i];
+                Collision &hit = hits[entry.trace];
+                if (hit) {
+                    continue;
+                }
+                BSP_COUNT(polygonTests, 1);
+                const auto &trace = traces[entry.trace];
+                Point3D point(trace.origin[0] + trace.direction[0] * entry.tMin,
+                              trace.origin[1] + trace.direction[1] * entry.tMin,
+                              trace.origin[2] + trace.direction[2] * entry.tMin);
+                if (polygon.contains(point, normal)) {
+                    hit.polygon = &polygon;
+                    hit.distance = trace.length * entry.tMin;
+                    hit.point = point;
+                }
+            }
+        }
+        size_t kept = begin;
+        for (size_t i = begin; i < end; ++i) {
+            if (!hits[packet[i].trace]) {
+                packet[kept++] = packet[i];
+            }
+        }
+        return kept;
+    };
+    // segments starting in front: front child, this node, and the rest goes behind together with the
+    // segments starting behind (both regions are contiguous), which then reach this node and the front
+    walk(front, frontNearBounds, nearBase, frontNear);
+    frontFar = testPartition(farBase, frontFar);
+    backNearBounds.extend(frontFarBounds);
+    walk(back, backNearBounds, backNear, frontFar);
+    walk(front, backFarBounds, backFar, testPartition(backFar, farEnd));
+    packet.resize(nearBase);
+}
+
+SweepHit BSPNode::sweepSphere(const SphereSweep &sweep) const {
+    BSP_COUNT(queries, 1);
+    SphereSweepState state;
+    state.trace = {{sweep.start.getX().getValue(), sweep.start.getY().getValue(), sweep.start.getZ().getValue()},
+                   {(sweep.end.getX() - sweep.start.getX()).getValue(), (sweep.end.getY() - sweep.start.getY()).getValue(),
+                    (sweep.end.getZ() - sweep.start.getZ()).getValue()},
+                   sweep.radius.getValue()};
+    // the polygons touched at the start stop the sphere now, or are left out of the sweep
+    state.startPass = true;
+    sweepNode(this, state, 0, 0);
+    if (state.polygon == nullptr) {
+        state.startPass = false;
+        state.time = 1;
+        sweepNode(this, state, 0, 1);
+    }
+    SweepHit hit;
+    if (state.polygon != nullptr) {
+        hit.polygon = state.polygon;
+        hit.time = state.time;
+        hit.point = Point3D(state.point[0], state.point[1], state.point[2]);
+        hit.normal = Vector3D(state.normal[0], state.normal[1], state.normal[2]);
+    }
+    return hit;
+}
+
+void BSPNode::sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits) const {
+    for (size_t i = 0; i < count; ++i) {
+        hits[i] = sweepSphere(sweeps[i]);
+    }
+}
+
+NearestPolygon BSPNode::nearestPolygon(const Point3D &point, NType maxDistance) const {
+    BSP_COUNT(queries, 1);
+    NearestState state;
+    state.point = point;
+    state.xyz[0] = point.getX().getValue(), state.xyz[1] = point.getY().getValue(), state.xyz[2] = point.getZ().getValue();
+    state.distance = maxDistance.getValue();
+    nearestNode(this, state);
+    NearestPolygon nearest;
+    if (state.polygon != nullptr) {
+        nearest.polygon = state.polygon;
+        nearest.distance = state.distance;
+        nearest.point = state.closest;
+    }
+    return nearest;
+}
+
+void BSPNode::polygonsWithinRadius(const Point3D &point, NType radius, std::vector<const Polygon *> &result) const {
+    BSP_COUNT(queries, 1);
+    const double xyz[3] = {point.getX().getValue(), point.getY().getValue(), point.getZ().getValue()};
+    radiusNode(this, point, xyz, radius.getValue(), result);
+}
+
+void BSPNode::updateCounts() {
+    fragmentsCount = polygons.size();
+    splitFragmentsCount = ownSplitFragments;
+    nodesCount = 1;
+    height = 1;
+    for (const BSPNode *child: {front, back}) {
+        if (child != nullptr) {
+            fragmentsCount += child->fragmentsCount;
+            splitFragmentsCount += child->splitFragmentsCount;
+            nodesCount += child->nodesCount;
+            height = std::max(height, child->height + 1);
+        }
+    }
+}
+
+void BSPNode::updateSummary() {
+    updateCounts();
+    bounds = BoundingBox();
+    for (const auto &polygon: polygons) {
+        for (const auto &vertex: polygon.getVertices()) {
+            bounds.extend(vertex);
+        }
+    }
+    if (front != nullptr) {
+        bounds.extend(front->bounds);
+    }
+    if (back != nullptr) {
+        bounds.extend(back->bounds);
+    }
+}
+
+void BSPNode::refreshSummary() {
+    for (BSPNode *node = this; node != nullptr; node = node->parent) {
+        node->updateSummary();
+    }
+}
+
+void BSPNode::queryVolume(const Plane *planes, size_t count, std::vector<const Polygon *> &result) const {
+    // Nodes still to walk, with the planes their bounds are not fully in front of yet
+    struct Pending {
+        const BSPNode *node;
+        uint64_t planesMask;
+    };
+    BSP_COUNT(queries, 1);
+    std::vector<Pending> stack;
+    stack.push_back({this, count == 64 ? ~uint64_t(0) : (uint64_t(1) << count) - 1});
+    while (!stack.empty()) {
+        auto [node, planesMask] = stack.back();
+        stack.pop_back();
+        BSP_COUNT(nodesVisited, 1);
+        const auto &nodeBounds = node->bounds;
+        if (nodeBounds.isEmpty()) {
+            continue;
+        }
+        bool outside = false;
+        for (size_t i = 0; i < count && !outside; ++i) {
+            if (!(planesMask >> i & 1)) {
+                continue;
+            }
+            BSP_COUNT(planeTests, 1);
+            const double *equation = planes[i].getEquation();
+            if (nodeBounds.maxDistance(equation) < -CLASSIFY_EPSILON) {
+                outside = true;
+            } else if (nodeBounds.minDistance(equation) >= -CLASSIFY_EPSILON) {
+                planesMask &= ~(uint64_t(1) << i);
+            }
+        }
+        if (outside) {
+            continue;
+        }
+        if (planesMask == 0) {
+            node->collectPolygons(result);
+            continue;
+        }
+        for (const auto &polygon: node->polygons) {
+            bool behind = false;
+            for (size_t i = 0; i < count && !behind; ++i) {
+                BSP_COUNT(polygonTests, planesMask >> i & 1);
+                behind = (planesMask >> i & 1) && classifyPolygon(vertexData(polygon.getVertices().data()),
+                                                                   polygon.getVertices().size(),
+                                                                   planes[i].getEquation(), CLASSIFY_EPSILON) == BEHIND;
+            }
+            if (!behind) {
+                result.push_back(&polygon);
+            }
+        }
+        if (node->back != nullptr) {
+            stack.push_back({node->back, planesMask});
+        }
+        if (node->front != nullptr) {
+            stack.push_back({node->front, planesMask});
+        }
+    }
+}
+
+void BSPNode::collectPolygons(std::vector<const Polygon *> &result) const {
+    for (const auto &polygon: polygons) {
+        result.push_back(&polygon);
+    }
+    if (front != nullptr) {
+        front->collectPolygons(result);
+    }
+    if (back != nullptr) {
+        back->collectPolygons(result);
+    }
 }
 
-const Polygon *BSPNode::detectCollision(const LineSegment &traceLine) const {
-    auto p0 = traceLine.getP1();
-    auto pf = traceLine.getP2();
+bool BSPNode::contains(const Point3D &pt) const {
+    return classifyPoint(pt) != OUTSIDE;
+}
 
+PointLocation BSPNode::classifyPoint(const Point3D &point) const {
+    const BSPNode *node = this;
+    while (true) {
+        BSP_COUNT(nodesVisited, 1);
+        BSP_COUNT(planeTests, 1);
+        auto distance = node->partition.distance(point);
+        if (distance > 0) {
+            if (node->front == nullptr) {
+                return OUTSIDE;
+            }
+            node = node->front;
+        } else if (distance < 0) {
+            if (node->back == nullptr) {
+                return INSIDE;
+            }
+            node = node->back;
+        } else {
+            PointLocation inFront = node->front != nullptr ? node->front->classifyPoint(point) : OUTSIDE;
+            PointLocation behind = node->back != nullptr ? node->back->classifyPoint(point) : INSIDE;
+            return inFront == behind ? inFront : ON_BOUNDARY;
+        }
+    }
+}
 
-    // if same node, nullptr
+void BSPNode::classifyPoints(PointPacket &packet, size_t first, size_t last, PointLocation *locations) const {
+    double *xyz = packet.xyz.data();
+    size_t *indices = packet.indices.data();
+    double *distances = packet.distances.data();
+    BSP_COUNT(nodesVisited, last - first);
+    BSP_COUNT(planeTests, last - first);
+    planeDistances(xyz + 3 * first, last - first, partition.getEquation(), distances + first);
 
-    // else, find common ancestor
+    // three way partition: [first, onPlane) behind, [onPlane, inFront) on the plane, [inFront, last) in front
+    auto swapPoints = [&](size_t i, size_t j) {
+        std::swap(xyz[3 * i], xyz[3 * j]);
+        std::swap(xyz[3 * i + 1], xyz[3 * j + 1]);
+        std::swap(xyz[3 * i + 2], xyz[3 * j + 2]);
+        std::swap(indices[i], indices[j]);
+        std::swap(distances[i], distances[j]);
+    };
+    size_t onPlane = first, current = first, inFront = last;
+    while (current < inFront) {
+        if (distances[current] < -CLASSIFY_EPSILON) {
+            swapPoints(current++, onPlane++);
+        } else if (distances[current] > CLASSIFY_EPSILON) {
+            swapPoints(current, --inFront);
+        } else {
+            current++;
+        }
+    }
 
-//   if (parent->getPartition().inPositiveSide(p0) && parent->getPartition().inPositiveSide(pf)) {
-//       // node is common ancestor
-//       if ()
-//   }
-//   else {
-//       return parent->detectCollision(traceLine);
-//   }
+    if (back != nullptr && onPlane > first) {
+        back->classifyPoints(packet, first, onPlane, locations);
+    } else {
+        for (size_t i = first; i < onPlane; ++i) {
+            locations[indices[i]] = INSIDE;
+        }
+    }
+    // rare: points on the partition need both sides
+    for (size_t i = onPlane; i < inFront; ++i) {
+        locations[indices[i]] = classifyPoint(Point3D(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]));
+    }
+    if (front != nullptr && last > inFront) {
+        front->classifyPoints(packet, inFront, last, locations);
+    } else {
+        for (size_t i = inFront; i < last; ++i) {
+            locations[indices[i]] = OUTSIDE;
+        }
+    }
 }
 
 BSPNode *BSPNode::visibilityOrder(const Point3D &point) {
-    if (front == nullptr && back == nullptr) {
-        return this;
+    // descend on the side of the point while there is a child there
+    BSPNode *node = this;
+    while (true) {
+        BSPNode *side = node->partition.inPositiveSide(point) ? node->front : node->back;
+        if (side == nullptr) {
+            return node;
+        }
+        node = side;
+    }
+}
+
+PolygonId BSPTree::insert(const Polygon &polygon) {
+    if (polygon.isDegenerate()) {
+        return NO_POLYGON_ID;
+    }
+    PolygonId id = nextId++;
+    // the copy carrying the id and the fragment nodes stay on the stack for the usual polygon
+    alignas(std::max_align_t) std::byte buffer[INSERT_BUFFER];
+    std::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer));
+    Polygon *tagged = keepSources ? Arena::create<Polygon>(arena.getResource(), polygon, arena.getResource())
+                                  : Arena::create<Polygon>(&resource, polygon, &resource);
+    tagged->setId(id);
+    std::pmr::vector<BSPNode *> placed(&resource);
+    if (root == nullptr) {
+        root = Arena::create<BSPNode>(arena.getResource(), polygon.getPlane(), arena.getResource());
     }
-    if (partition.inPositiveSide(point)) {
-        return front->visibilityOrder(point);
+    root->insert(*tagged, &placed);
+    if (placed.empty()) {
+        // only slivers were left after splitting it
+        return NO_POLYGON_ID;
     }
-    else {
-        return back->visibilityOrder(point);
+    sourcePolygonsCount++;
+    if (placed.size() > 1) {
+        for (BSPNode *node: placed) {
+            node->setOwnSplitFragments(node->getOwnSplitFragments() + 1);
+            node->refreshSummary();
+        }
     }
+    if (sources != nullptr) {
+        auto &source = (*sources)[id];
+        source.polygon = keepSources ? tagged : nullptr;
+        source.nodes.assign(placed.begin(), placed.end());
+    }
+    if (rebuildPolicy.enabled) {
+        rebuildDegraded(std::vector<BSPNode *>(placed.begin(), placed.end()));
+    }
+    return id;
+}
+
+bool BSPTree::remove(PolygonId id) {
+    trackSources();
+    auto found = sources->find(id);
+    if (found == sources->end()) {
+        return false;
+    }
+    std::vector<BSPNode *> nodes(found->second.nodes.begin(), found->second.nodes.end());
+    sources->erase(found);
+    sourcePolygonsCount--;
+    solid = false;
+
+    bool split = nodes.size() > 1;
+    for (BSPNode *node: nodes) {
+        size_t removed = node->removePolygons(id);
+        if (split) {
+            node->setOwnSplitFragments(node->getOwnSplitFragments() - removed);
+        }
+    }
+    std::vector<BSPNode *> changed;
+    for (BSPNode *node: nodes) {
+        // a node may be listed twice, or be gone with an ancestor collapsed before it
+        if (node != root && node->getParent() == nullptr) {
+            continue;
+        }
+        BSPNode *survivor = collapse(node);
+        if (survivor != nullptr) {
+            survivor->refreshSummary();
+            changed.push_back(survivor);
+        }
+    }
+    rebuildDegraded(changed);
+    return true;
+}
+
+const Polygon *BSPTree::getSourcePolygon(PolygonId id) const {
+    if (sources == nullptr) {
+        return nullptr;
+    }
+    auto found = sources->find(id);
+    return found != sources->end() ? found->second.polygon : nullptr;
+}
+
+void BSPTree::setKeepSourcePolygons(bool keep) {
+    keepSources = keep;
+    if (keepSources) {
+        trackSources();
+    }
+}
+
+void BSPTree::setRebuildPolicy(const RebuildPolicy &policy) {
+    rebuildPolicy = policy;
+    if (rebuildPolicy.enabled) {
+        trackSources();
+    }
+}
+
+void BSPTree::createSources() {
+    sources = Arena::create<SourceMap>(arena.getResource(), arena.getResource());
+    sources->reserve(sourcePolygonsCount);
+}
+
+void BSPTree::trackSources() {
+    if (sources != nullptr) {
+        return;
+    }
+    createSources();
+    if (root != nullptr) {
+        registerFragments(root);
+    }
+}
+
+void BSPTree::replaceSubtree(BSPNode *old, BSPNode *replacement) {
+    BSPNode *parent = old->getParent();
+    if (parent == nullptr) {
+        root = replacement;
+    } else if (parent->front == old) {
+        parent->front = replacement;
+    } else {
+        parent->back = replacement;
+    }
+    if (replacement != nullptr) {
+        replacement->setParent(parent);
+    }
+}
+
+BSPNode *BSPTree::collapse(BSPNode *node) {
+    // an empty node with one child only splits off empty space: the child takes its place
+    while (node->polygons.empty() && (node->front == nullptr || node->back == nullptr)) {
+        BSPNode *child = node->front != nullptr ? node->front : node->back;
+        BSPNode *parent = node->getParent();
+        replaceSubtree(node, child);
+        node->parent = node->front = node->back = nullptr;
+        if (parent == nullptr) {
+            return child;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+bool BSPTree::isDegraded(const BSPNode *node) const {
+    const auto &policy = rebuildPolicy;
+    auto fragments = static_cast<double>(node->getFragmentsCount());
+    if (node->getFragmentsCount() < policy.minPolygons) {
+        return false;
+    }
+    auto rebuilt = static_cast<double>(node->getRebuiltFragments());
+    if (rebuilt > 0 && std::abs(fragments - rebuilt) * 4 < rebuilt) {
+        return false;
+    }
+    return static_cast<double>(node->getHeight()) > policy.maxDepthRatio * std::log2(fragments + 1) ||
+           static_cast<double>(node->getSplitFragmentsCount()) > policy.maxSplitRatio * fragments ||
+           static_cast<double>(node->getNodesCount()) > policy.maxNodesRatio * fragments;
+}
+
+void BSPTree::rebuildDegraded(const std::vector<BSPNode *> &changed) {
+    if (!rebuildPolicy.enabled) {
+        return;
+    }
+    // the highest degraded ancestor of every changed node, without the ones inside another
+    std::vector<BSPNode *> targets;
+    for (BSPNode *node: changed) {
+        BSPNode *target = nullptr;
+        for (BSPNode *ancestor = node; ancestor != nullptr; ancestor = ancestor->getParent()) {
+            if (isDegraded(ancestor)) {
+                target = ancestor;
+            }
+        }
+        if (target != nullptr && std::find(targets.begin(), targets.end(), target) == targets.end()) {
+            targets.push_back(target);
+        }
+    }
+    for (BSPNode *target: targets) {
+        bool nested = false;
+        for (BSPNode *ancestor = target->getParent(); ancestor != nullptr && !nested; ancestor = ancestor->getParent()) {
+            nested = std::find(targets.begin(), targets.end(), ancestor) != targets.end();
+        }
+        if (!nested) {
+            rebuildSubtree(target);
+        }
+    }
+}
+
+namespace {
+
+// Polygons of a node once classified against its partition
+struct PartitionedPolygons {
+    std::vector<Polygon> coincident, front, back;
+    size_t splits = 0;
+};
+
+void partitionPolygons(const std::vector<Polygon> &polygons, size_t first, size_t last, const Plane &partition,
+                       PartitionedPolygons &out) {
+    SplitBuffer parts;
+    for (size_t i = first; i < last; ++i) {
+        const auto &polygon = polygons[i];
+        switch (polygon.relationWithPlane(partition)) {
+            case COINCIDENT:
+                out.coincident.push_back(polygon);
+                break;
+            case IN_FRONT:
+                out.front.push_back(polygon);
+                break;
+            case BEHIND:
+                out.back.push_back(polygon);
+                break;
+            case SPLIT:
+                out.splits++;
+                parts.split(polygon, partition);
+                if (!parts.front.isDegenerate()) {
+                    out.front.push_back(parts.front);
+                }
+                if (!parts.back.isDegenerate()) {
+                    out.back.push_back(parts.back);
+                }
+                break;
+        }
+    }
+}
+
+void mergeStats(BuildStats &stats, const BuildStats &other) {
+    stats.polygons += other.polygons;
+    stats.splits += other.splits;
+    stats.nodes += other.nodes;
+    stats.depth = std::max(stats.depth, other.depth);
+}
+
+// Parent links and summary of a node whose children are complete
+void linkChildren(BSPNode *node) {
+    if (node->front != nullptr) {
+        node->front->setParent(node);
+    }
+    if (node->back != nullptr) {
+        node->back->setParent(node);
+    }
+    node->updateSummary();
+}
+
+BSPNode *buildNode(std::vector<Polygon> &polygons, const SplitterSelector &selector, size_t depth, BuildStats &stats,
+                   std::pmr::memory_resource *resource) {
+    if (polygons.empty()) {
+        return nullptr;
+    }
+    stats.nodes++;
+    stats.depth = std::max(stats.depth, depth);
+    auto *node = Arena::create<BSPNode>(resource, polygons[selector(polygons)].getPlane(), resource);
+    PartitionedPolygons parts;
+    partitionPolygons(polygons, 0, polygons.size(), node->partition, parts);
+    node->polygons.assign(std::make_move_iterator(parts.coincident.begin()),
+                          std::make_move_iterator(parts.coincident.end()));
+    stats.polygons += node->polygons.size();
+    stats.splits += parts.splits;
+    polygons.clear();
+    polygons.shrink_to_fit();
+
+    node->front = buildNode(parts.front, selector, depth + 1, stats, resource);
+    node->back = buildNode(parts.back, selector, depth + 1, stats, resource);
+    linkChildren(node);
+    return node;
+}
+
+// Same tree as buildNode: the classification of a node runs as a parallel pass over chunks of
+// 'grainSize' polygons (concatenated in order) and the two subtrees are built as separate tasks,
+// down to subsets of 'grainSize' polygons which are built sequentially. Every task allocates its
+// subtree from its own resource of the arena
+BSPNode *buildNodeParallel(std::vector<Polygon> &polygons, const SplitterSelector &selector, size_t depth,
+                           BuildStats &stats, ThreadPool &pool, size_t grainSize, Arena &arena,
+                           std::pmr::memory_resource *resource) {
+    if (polygons.size() <= grainSize) {
+        return buildNode(polygons, selector, depth, stats, resource);
+    }
+    stats.nodes++;
+    stats.depth = std::max(stats.depth, depth);
+    auto *node = Arena::create<BSPNode>(resource, polygons[selector(polygons)].getPlane(), resource);
+
+    std::vector<PartitionedPolygons> chunks((polygons.size() + grainSize - 1) / grainSize);
+    parallelFor(pool, 0, chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            partitionPolygons(polygons, chunk * grainSize, std::min((chunk + 1) * grainSize, polygons.size()),
+                              node->partition, chunks[chunk]);
+        }
+    });
+    polygons.clear();
+    polygons.shrink_to_fit();
+    std::vector<Polygon> frontPolygons, backPolygons;
+    for (auto &chunk: chunks) {
+        std::move(chunk.coincident.begin(), chunk.coincident.end(), std::back_inserter(node->polygons));
+        std::move(chunk.front.begin(), chunk.front.end(), std::back_inserter(frontPolygons));
+        std::move(chunk.back.begin(), chunk.back.end(), std::back_inserter(backPolygons));
+        stats.splits += chunk.splits;
+    }
+    chunks.clear();
+    stats.polygons += node->polygons.size();
+
+    BuildStats frontStats, backStats;
+    TaskGroup group(pool);
+    group.run([&] {
+        node->front = buildNodeParallel(frontPolygons, selector, depth + 1, frontStats, pool, grainSize, arena,
+                                        arena.createResource());
+    });
+    node->back = buildNodeParallel(backPolygons, selector, depth + 1, backStats, pool, grainSize, arena, resource);
+    group.wait();
+    mergeStats(stats, frontStats);
+    mergeStats(stats, backStats);
+    linkChildren(node);
+    return node;
+}
+
+} // namespace
+
+void BSPTree::prepareBuild(std::vector<Polygon> &polygons, BuildStats &stats) {
+    arena.release();
+    solid = false;
+    stats.inputPolygons = polygons.size();
+    for (size_t i = 0; i < polygons.size(); ++i) {
+        polygons[i].setId(static_cast<PolygonId>(i));
+    }
+    nextId = static_cast<PolygonId>(polygons.size());
+    polygons.erase(std::remove_if(polygons.begin(), polygons.end(),
+                                  [](const Polygon &polygon) { return polygon.isDegenerate(); }),
+                   polygons.end());
+    sources = nullptr;
+    sourcePolygonsCount = polygons.size();
+    if (keepSources) {
+        createSources();
+        for (const auto &polygon: polygons) {
+            (*sources)[polygon.getId()].polygon =
+                    Arena::create<Polygon>(arena.getResource(), polygon, arena.getResource());
+        }
+    }
+}
+
+void BSPTree::finishBuild() {
+    // fragments of every id, the ids of a build are below nextId
+    std::vector<uint32_t> fragmentsById(nextId, 0);
+    std::vector<BSPNode *> stack;
+    if (root != nullptr) {
+        stack.push_back(root);
+    }
+    while (!stack.empty()) {
+        BSPNode *node = stack.back();
+        stack.pop_back();
+        for (const auto &polygon: node->getPolygons()) {
+            fragmentsById[polygon.getId()]++;
+        }
+        for (BSPNode *child: {node->front, node->back}) {
+            if (child != nullptr) {
+                stack.push_back(child);
+            }
+        }
+    }
+    // slivers may have dropped a polygon whole
+    sourcePolygonsCount = fragmentsById.size() - std::count(fragmentsById.begin(), fragmentsById.end(), 0u);
+    if (root == nullptr) {
+        return;
+    }
+    countSplitFragments(root, [&fragmentsById](PolygonId id) { return fragmentsById[id]; });
+    if (sources != nullptr) {
+        registerFragments(root);
+    } else if (rebuildPolicy.enabled) {
+        trackSources();
+    }
+}
+
+BuildStats BSPTree::build(std::vector<Polygon> polygons, const SplitterSelector &selector) {
+    BuildStats stats;
+    prepareBuild(polygons, stats);
+    root = buildNode(polygons, selector, 1, stats, arena.getResource());
+    finishBuild();
+    return stats;
+}
+
+BuildStats BSPTree::build(std::vector<Polygon> polygons, const SplitterSelector &selector, ThreadPool &pool,
+                          size_t grainSize) {
+    BuildStats stats;
+    prepareBuild(polygons, stats);
+    root = buildNodeParallel(polygons, selector, 1, stats, pool, std::max<size_t>(grainSize, 1), arena,
+                             arena.getResource());
+    finishBuild();
+    return stats;
+}
+
+void BSPTree::registerFragments(BSPNode *subtree) {
+    std::vector<BSPNode *> stack = {subtree};
+    while (!stack.empty()) {
+        BSPNode *node = stack.back();
+        stack.pop_back();
+        for (const auto &polygon: node->getPolygons()) {
+            (*sources)[polygon.getId()].nodes.push_back(node);
+        }
+        for (BSPNode *child: {node->front, node->back}) {
+            if (child != nullptr) {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+template <typename FragmentsOf>
+void BSPTree::countSplitFragments(BSPNode *node, const FragmentsOf &fragmentsOf) {
+    size_t own = 0;
+    for (const auto &polygon: node->getPolygons()) {
+        own += fragmentsOf(polygon.getId()) > 1 ? 1 : 0;
+    }
+    node->setOwnSplitFragments(own);
+    for (BSPNode *child: {node->front, node->back}) {
+        if (child != nullptr) {
+            countSplitFragments(child, fragmentsOf);
+        }
+    }
+    node->updateSummary();
+}
+
+void BSPTree::rebuildSubtree(BSPNode *node) {
+    std::vector<BSPNode *> oldNodes = {node};
+    std::unordered_map<PolygonId, size_t> fragmentsHere;
+    for (size_t i = 0; i < oldNodes.size(); ++i) {
+        for (const auto &polygon: oldNodes[i]->getPolygons()) {
+            fragmentsHere[polygon.getId()]++;
+        }
+        for (BSPNode *child: {oldNodes[i]->front, oldNodes[i]->back}) {
+            if (child != nullptr) {
+                oldNodes.push_back(child);
+            }
+        }
+    }
+    std::unordered_set<const BSPNode *> oldSet(oldNodes.begin(), oldNodes.end());
+
+    // kept polygons with all their fragments in here start over from the polygon as given, which
+    // undoes their splits, the others keep their fragments
+    auto restarts = [this, &fragmentsHere](PolygonId id) {
+        auto source = sources->find(id);
+        return source != sources->end() && source->second.polygon != nullptr &&
+               source->second.nodes.size() == fragmentsHere[id];
+    };
+    std::vector<Polygon> polygons;
+    for (const auto &entry: fragmentsHere) {
+        if (restarts(entry.first)) {
+            polygons.push_back(*sources->find(entry.first)->second.polygon);
+        }
+    }
+    for (const BSPNode *current: oldNodes) {
+        for (const auto &polygon: current->getPolygons()) {
+            if (!restarts(polygon.getId())) {
+                polygons.push_back(polygon);
+            }
+        }
+    }
+    for (const auto &entry: fragmentsHere) {
+        auto source = sources->find(entry.first);
+        if (source != sources->end()) {
+            auto &nodes = source->second.nodes;
+            nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                                       [&oldSet](const BSPNode *fragmentNode) { return oldSet.count(fragmentNode) > 0; }),
+                        nodes.end());
+        }
+    }
+
+    BuildStats stats;
+    BSPNode *replacement = buildNode(polygons, rebuildPolicy.selector, 1, stats, arena.getResource());
+    replaceSubtree(node, replacement);
+    node->parent = node->front = node->back = nullptr;
+    if (replacement != nullptr) {
+        registerFragments(replacement);
+        countSplitFragments(replacement, [this](PolygonId id) { return (*sources)[id].nodes.size(); });
+        replacement->setRebuiltFragments(replacement->getFragmentsCount());
+        replacement->refreshSummary();
+    }
+    rebuildsCount++;
+}
+
+BuildStats BSPTree::buildSolid(std::vector<Polygon> polygons, const SplitterSelector &selector) {
+    BuildStats stats = build(std::move(polygons), selector);
+    solid = true;
+    return stats;
 }
 
-BSPNode *BSPNode::getFirstCommonAncestor(BSPNode *node1, BSPNode *node2) {
-    std::stack<BSPNode *> st1, st2;
-    while (node1->getParent() != nullptr) {
-        st1.push(node1);
-        node1 = node1->getParent();
+BuildStats BSPTree::buildSolid(std::vector<Polygon> polygons, const SplitterSelector &selector, ThreadPool &pool,
+                               size_t grainSize) {
+    BuildStats stats = build(std::move(polygons), selector, pool, grainSize);
+    solid = true;
+    return stats;
+}
+
+TreeStats BSPTree::stats() const {
+    TreeStats stats;
+    stats.sourcePolygons = sourcePolygonsCount;
+    if (sources != nullptr) {
+        stats.sourceBytes = sizeof(SourceMap) + sources->bucket_count() * sizeof(void *);
+        for (const auto &entry: *sources) {
+            stats.sourceBytes += sizeof(entry) + entry.second.nodes.capacity() * sizeof(BSPNode *);
+            if (entry.second.polygon != nullptr) {
+                stats.sourceBytes += sizeof(Polygon) + entry.second.polygon->getVertices().capacity() * sizeof(Point3D);
+            }
+        }
     }
-    while (node2->getParent() != nullptr) {
-        st2.push(node2);
-        node2 = node2->getParent();
+    if (root == nullptr) {
+        return stats;
     }
-    BSPNode *firstCommonAncestor = st1.top();
-    while (!st1.empty() && !st2.empty() && st1.top() == st2.top()) {
-        st1.pop();
-        st2.pop();
+    stats.fragments = root->getFragmentsCount();
+    stats.splitFragments = root->getSplitFragmentsCount();
+    stats.height = root->getHeight();
+    stats.depthHistogram.assign(stats.height, 0);
+
+    size_t leafDepths = 0;
+    std::vector<std::pair<const BSPNode *, size_t>> stack = {{root, 1}};
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        stats.nodes++;
+        stats.depthHistogram[depth - 1]++;
+        stats.emptyNodes += node->getPolygons().empty() ? 1 : 0;
+        stats.nodeBytes += sizeof(BSPNode) + node->getPolygons().capacity() * sizeof(Polygon);
+        for (const auto &polygon: node->getPolygons()) {
+            stats.vertexBytes += polygon.getVertices().capacity() * sizeof(Point3D);
+        }
+        if (node->getFront() == nullptr && node->getBack() == nullptr) {
+            stats.leaves++;
+            leafDepths += depth;
+        }
+        for (const BSPNode *child: {node->getFront(), node->getBack()}) {
+            if (child != nullptr) {
+                stack.emplace_back(child, depth + 1);
+            }
+        }
     }
-    return firstCommonAncestor;
+    stats.averagePolygonsPerNode = static_cast<double>(stats.fragments) / static_cast<double>(stats.nodes);
+    stats.averageLeafDepth = static_cast<double>(leafDepths) / static_cast<double>(stats.leaves);
+    return stats;
 }
 
+PointLocation BSPTree::classifyPoint(const Point3D &point) const {
+    if (!solid) {
+        throw std::runtime_error("classifyPoint needs a tree built by buildSolid");
+    }
+    BSP_COUNT(queries, 1);
+    return root != nullptr ? root->classifyPoint(point) : OUTSIDE;
+}
 
-void BSPTree::insert(const Polygon &polygon) {
+void BSPTree::classifyPoints(const Point3D *points, size_t count, PointLocation *locations) const {
+    if (!solid) {
+        throw std::runtime_error("classifyPoints needs a tree built by buildSolid");
+    }
+    BSP_COUNT(queries, count);
     if (root == nullptr) {
-        root = new BSPNode(polygon.getPlane());
+        std::fill_n(locations, count, OUTSIDE);
+        return;
     }
-    root->insert(polygon);
+    PointPacket packet;
+    for (size_t first = 0; first < count; first += POINTS_BLOCK) {
+        size_t blockSize = std::min(count - first, POINTS_BLOCK);
+        const double *xyz = vertexData(points + first);
+        packet.xyz.assign(xyz, xyz + 3 * blockSize);
+        packet.indices.resize(blockSize);
+        for (size_t i = 0; i < blockSize; ++i) {
+            packet.indices[i] = i;
+        }
+        packet.distances.resize(blockSize);
+        root->classifyPoints(packet, 0, blockSize, locations + first);
+    }
+}
+
+void BSPTree::classifyPoints(const Point3D *points, size_t count, PointLocation *locations, ThreadPool &pool) const {
+    parallelFor(pool, 0, count, POINTS_BLOCK, [&](size_t begin, size_t end) {
+        classifyPoints(points + begin, end - begin, locations + begin);
+    });
+}
+
+std::vector<PointLocation> BSPTree::classifyPoints(const std::vector<Point3D> &points) const {
+    std::vector<PointLocation> locations(points.size());
+    classifyPoints(points.data(), points.size(), locations.data());
+    return locations;
+}
+
+void BSPTree::queryVolume(const std::vector<Plane> &planes, std::vector<const Polygon *> &result) const {
+    if (planes.size() > 64) {
+        throw std::runtime_error("queryVolume supports at most 64 planes");
+    }
+    if (root != nullptr) {
+        root->queryVolume(planes.data(), planes.size(), result);
+    }
+}
+
+std::vector<const Polygon *> BSPTree::queryVolume(const std::vector<Plane> &planes) const {
+    std::vector<const Polygon *> result;
+    queryVolume(planes, result);
+    return result;
+}
+
+Collision BSPTree::detectCollision(const LineSegment &traceLine) const {
+    return root ? root->detectCollision(traceLine) : Collision();
+}
+
+void BSPTree::detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const {
+    if (root != nullptr) {
+        root->detectCollisions(traceLines, count, hits);
+    } else {
+        std::fill_n(hits, count, Collision());
+    }
+}
+
+std::vector<Collision> BSPTree::detectCollisions(const std::vector<LineSegment> &traceLines) const {
+    std::vector<Collision> hits(traceLines.size());
+    detectCollisions(traceLines.data(), traceLines.size(), hits.data());
+    return hits;
 }
 
-const Polygon *BSPTree::detectCollision(const LineSegment &traceLine) const {
-    if (root == nullptr) return nullptr;
-    // get nodo for p1 and p2
-    auto node0 = root->visibilityOrder(traceLine.getP1());
-    auto nodef = root->visibilityOrder(traceLine.getP2());
-    // if its the same node, null
-    if (node0 == nodef) return nullptr;
-    // else, find common ancestor
-    auto ancestor = BSPNode::getFirstCommonAncestor(node0, nodef);
+void BSPTree::detectCoherentCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const {
+    if (root != nullptr) {
+        root->detectCoherentCollisions(traceLines, count, hits);
+    } else {
+        std::fill_n(hits, count, Collision());
+    }
+}
+
+std::vector<Collision> BSPTree::detectCoherentCollisions(const std::vector<LineSegment> &traceLines) const {
+    std::vector<Collision> hits(traceLines.size());
+    detectCoherentCollisions(traceLines.data(), traceLines.size(), hits.data());
+    return hits;
+}
+
+NearestPolygon BSPTree::nearestPolygon(const Point3D &point, NType maxDistance) const {
+    return root ? root->nearestPolygon(point, maxDistance) : NearestPolygon();
+}
+
+void BSPTree::polygonsWithinRadius(const Point3D &point, NType radius, std::vector<const Polygon *> &result) const {
+    if (root != nullptr) {
+        root->polygonsWithinRadius(point, radius, result);
+    }
+}
+
+std::vector<const Polygon *> BSPTree::polygonsWithinRadius(const Point3D &point, NType radius) const {
+    std::vector<const Polygon *> result;
+    polygonsWithinRadius(point, radius, result);
+    return result;
+}
+
+SweepHit BSPTree::sweepSphere(const SphereSweep &sweep) const {
+    return root ? root->sweepSphere(sweep) : SweepHit();
+}
+
+void BSPTree::sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits) const {
+    if (root != nullptr) {
+        root->sweepSpheres(sweeps, count, hits);
+    } else {
+        std::fill_n(hits, count, SweepHit());
+    }
+}
+
+void BSPTree::sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits, ThreadPool &pool) const {
+    parallelFor(pool, 0, count, SWEEPS_BLOCK, [&](size_t begin, size_t end) {
+        sweepSpheres(sweeps + begin, end - begin, hits + begin);
+    });
+}
 
-    return root ? root->detectCollision(traceLine) : nullptr;
+std::vector<SweepHit> BSPTree::sweepSpheres(const std::vector<SphereSweep> &sweeps) const {
+    std::vector<SweepHit> hits(sweeps.size());
+    sweepSpheres(sweeps.data(), sweeps.size(), hits.data());
+    return hits;
 }
@@ -5,90 +5,514 @@
 #include "Point.h"
 #include "Line.h"
 #include "Plane.h"
+#include "Arena.h"
+#include "BoundingBox.h"
+#include "Splitter.h"
+#include "ThreadPool.h"
+#include <limits>
+#include <memory_resource>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+// Result of a segment query: the first polygon hit, how far along the segment and where
+struct Collision {
+    const Polygon *polygon = nullptr;
+    NType distance;
+    Point3D point;
+
+    explicit operator bool() const { return polygon != nullptr; }
+};
+
+// Result of a nearest polygon query: the polygon, its distance to the query point and the point
+// of the polygon nearest to it
+struct NearestPolygon {
+    const Polygon *polygon = nullptr;
+    NType distance;
+    Point3D point;
+
+    explicit operator bool() const { return polygon != nullptr; }
+};
+
+// A sphere moving from start to end, in a straight line (an entity during a tick)
+struct SphereSweep {
+    Point3D start, end;
+    NType radius;
+};
+
+// Result of a sphere sweep: the first polygon the sphere touches, the time of impact as a fraction
+// of the motion (the sphere stops at start + time * (end - start)), the contact point on the
+// polygon and the contact normal, of unit length, from the contact point towards the center
+struct SweepHit {
+    const Polygon *polygon = nullptr;
+    NType time = 1;
+    Point3D point;
+    Vector3D normal;
+
+    explicit operator bool() const { return polygon != nullptr; }
+};
+
+// A segment of a packet query in raw doubles: origin + t * direction, t in [0, 1]
+struct SegmentTrace {
+    double origin[3];
+    double direction[3];
+    double length;      // of the direction
+
+    void pointAt(double t, double point[3]) const {
+        for (int i = 0; i < 3; ++i) {
+            point[i] = origin[i] + direction[i] * t;
+        }
+    }
+};
+
+// Entry of a packet while it walks the tree: the segment and the part of it still to test
+struct PacketEntry {
+    uint32_t trace;
+    double tMin, tMax;
+};
+
+// Where a point is with respect to the solid of a tree built by BSPTree::buildSolid
+enum PointLocation { INSIDE, OUTSIDE, ON_BOUNDARY };
+
+// Points of a batched classification while they walk the tree. The coordinates are reordered
+// so that the points reaching a node are contiguous: the plane test of a node is one kernel call
+struct PointPacket {
+    std::vector<double> xyz;        // x, y, z of the points, in packet order
+    std::vector<size_t> indices;    // position of each point in the caller's array
+    std::vector<double> distances;
+};
+
+// Order of the polygons in a visibility traversal, as seen from the eye
+enum TraversalOrder { BACK_TO_FRONT, FRONT_TO_BACK };
+
+// Shape and memory of a tree as it is now, see BSPTree::stats
+struct TreeStats {
+    size_t nodes = 0;
+    size_t leaves = 0;                  // nodes without children
+    size_t emptyNodes = 0;              // nodes without polygons
+    size_t fragments = 0;               // polygons stored in the nodes
+    size_t splitFragments = 0;          // of them, pieces of split polygons
+    size_t sourcePolygons = 0;          // polygons given to insert and build
+    size_t height = 0;                  // nodes on the longest root to leaf path
+    double averagePolygonsPerNode = 0;
+    double averageLeafDepth = 0;
+    std::vector<size_t> depthHistogram; // depthHistogram[d]: nodes at depth d + 1 (the root is depth 1)
+    size_t nodeBytes = 0;               // nodes and their polygon arrays
+    size_t vertexBytes = 0;             // vertex arrays of the stored polygons
+    size_t sourceBytes = 0;             // fragment nodes and polygons kept by id for remove and rebuilds
+
+    size_t memoryBytes() const { return nodeBytes + vertexBytes + sourceBytes; }
+};
+
+// Shape of a tree produced by BSPTree::build
+struct BuildStats {
+    size_t inputPolygons = 0;   // polygons given to the build
+    size_t polygons = 0;        // fragments stored in the tree
+    size_t splits = 0;          // polygons cut by a partition
+    size_t nodes = 0;
+    size_t depth = 0;           // nodes on the longest root to leaf path
+};
+
+// When BSPTree::insert and BSPTree::remove rebuild a subtree they touched, off by default. A subtree of at least
+// minPolygons fragments is rebuilt when one of its quality metrics goes past its limit:
+//   height > maxDepthRatio * log2(fragments + 1)       (unbalanced)
+//   splitFragments > maxSplitRatio * fragments         (too many pieces of split polygons)
+//   nodes > maxNodesRatio * fragments                  (nodes left without polygons by removals)
+// and it changed by a quarter since it was last rebuilt, so that a subtree that cannot do better
+// is not rebuilt over and over
+struct RebuildPolicy {
+    bool enabled = false;
+    size_t minPolygons = 64;
+    double maxDepthRatio = 3;
+    double maxSplitRatio = 0.9;
+    double maxNodesRatio = 1.5;
+    SplitterSelector selector = balancedSplitter();
+};
+
 class BSPNode {
 public: // TODO: change
     BSPNode *parent;
     BSPNode *front;
     BSPNode *back;
     Plane partition;
-    std::vector<Polygon> polygons;
+    std::pmr::vector<Polygon> polygons;
+
+private:
+    // Summary of the subtree, kept up to date by insert, build, remove and the setters
+    BoundingBox bounds;             // of all the polygons
+    size_t fragmentsCount;          // polygons
+    size_t splitFragmentsCount;     // polygons that are a piece of a split polygon
+    size_t ownSplitFragments;       // the same, for the polygons of this node only
+    size_t nodesCount;
+    size_t height;                  // nodes on the longest path down
+    size_t rebuiltFragments;        // fragments when the subtree was last rebuilt, 0 if never
+
+    // Number of segments walked together by detectCoherentCollisions
+    static constexpr size_t PACKET_SIZE = 256;
+
+    // The counts of the summary, from the polygons of the node and the children (not the bounds)
+    void updateCounts();
 
 public:
-    BSPNode(const Plane &partition) : partition(partition), front(nullptr), back(nullptr), parent(nullptr) {}
-    ~BSPNode() {
-        delete front;
-        delete back;
-    }
+    // The polygons (and their vertices) are allocated from 'resource', and so are the children
+    // created by insert. Children are not owned: the arena of the tree frees all the nodes at once
+    BSPNode(const Plane &partition, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : parent(nullptr), front(nullptr), back(nullptr), partition(partition), polygons(resource),
+              fragmentsCount(0), splitFragmentsCount(0), ownSplitFragments(0), nodesCount(1), height(1),
+              rebuiltFragments(0) {}
+    ~BSPNode() = default;
+
+    // Memory resource of the node, used for its children
+    std::pmr::memory_resource *getResource() const { return polygons.get_allocator().resource(); }
+
+    // Insert a polygon into the subtree (node). The nodes that received a fragment of it are
+    // appended to 'placed', once per fragment
+    void insert(const Polygon &polygon, std::pmr::vector<BSPNode *> *placed = nullptr);
 
-    // Insert a polygon into the subtree (node)
-    void insert(const Polygon &polygon);
+    // Remove the polygons of the node (not the subtree) with the given id, returns how many
+    size_t removePolygons(PolygonId id);
+
+    // Deepest node of the subtree whose cell contains the point
     BSPNode *visibilityOrder(const Point3D &point);
-    static BSPNode *getFirstCommonAncestor(BSPNode *node1, BSPNode *node2);
+
+    // Painter's order traversal of the subtree from 'eye': calls visitor(const Polygon &) for every
+    // polygon, back-to-front or front-to-back. The visitor may return false to stop the traversal,
+    // in which case traverse returns false as well. Iterative, without copying the polygons
+    template <typename Visitor>
+    bool traverse(const Point3D &eye, TraversalOrder order, Visitor &&visitor) const;
 
     // Getters
     BSPNode *getParent() const { return parent; }
     BSPNode *getFront() const { return front; }
     BSPNode *getBack() const { return back; }
     Plane getPartition() const { return partition; }
-    const std::vector<Polygon> &getPolygons() const { return polygons; }
+    const std::pmr::vector<Polygon> &getPolygons() const { return polygons; }
 
+    // Solid trees only: the point is inside the solid or on its boundary
     bool contains(const Point3D &pt) const;
 
+    // Solid trees only: location of the point, walking down to its cell. A missing back child is
+    // a solid cell, a missing front child an empty one. Points on a partition are looked up on
+    // both sides, they are on the boundary when the sides disagree
+    PointLocation classifyPoint(const Point3D &point) const;
+
+    // Batched classifyPoint of the points packet[first, last), locations[packet.indices[i]] is
+    // the result for packet point i. The range is reordered in place (back, on the plane, front)
+    void classifyPoints(PointPacket &packet, size_t first, size_t last, PointLocation *locations) const;
+
+    // Summary of the subtree
+    const BoundingBox &getBounds() const { return bounds; }
+    size_t getFragmentsCount() const { return fragmentsCount; }
+    size_t getSplitFragmentsCount() const { return splitFragmentsCount; }
+    size_t getNodesCount() const { return nodesCount; }
+    size_t getHeight() const { return height; }
+    size_t getRebuiltFragments() const { return rebuiltFragments; }
+
+    // Recompute the summary from the polygons of the node and the summaries of its children
+    void updateSummary();
+
+    // updateSummary on this node and all its ancestors, after the subtree changed
+    void refreshSummary();
+
     // Setters
     void setParent(BSPNode *parent) { this->parent = parent; }
-    void setFront(BSPNode *front) { this->front = front; }
-    void setBack(BSPNode *back) { this->back = back; }
+    void setFront(BSPNode *front) { this->front = front; refreshSummary(); }
+    void setBack(BSPNode *back) { this->back = back; refreshSummary(); }
     void setPartition(Plane partition) { this->partition = partition; }
-    void setPolygons(std::vector<Polygon> polygons) { this->polygons = polygons; }
-
+    void setPolygons(const std::vector<Polygon> &polygons) {
+        this->polygons.assign(polygons.begin(), polygons.end());
+        refreshSummary();
+    }
+    // How many polygons of the node are pieces of split polygons (the tree tracks which are)
+    size_t getOwnSplitFragments() const { return ownSplitFragments; }
+    void setOwnSplitFragments(size_t count) { ownSplitFragments = count; }
+    void setRebuiltFragments(size_t count) { rebuiltFragments = count; }
 
     // Detect collision with a line
-    const Polygon* detectCollision(const LineSegment& traceLine) const;
+    Collision detectCollision(const LineSegment& traceLine) const;
+
+    // Detect collisions for many lines at once, one detectCollision each. hits[i] is the result
+    // for traceLines[i]
+    void detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const;
+
+    // detectCollisions for bundles of segments close to each other, walked through the subtree
+    // in packets of PACKET_SIZE consecutive segments (traceSegments)
+    void detectCoherentCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const;
+
+    // Front-to-back traversal of the segment origin + t * direction, t in [tMin, tMax].
+    // Stops at the first hit and stores it in 'hit'. Subtrees whose bounds the segment misses are skipped
+    bool traceSegment(const Point3D &origin, const Vector3D &direction, NType tMin, NType tMax, Collision &hit) const;
+
+    // Packet version of traceSegment: walks packet[first, first + count) through the subtree together.
+    // 'packetBounds' holds the parts of the segments still to test inside the bounds of the node.
+    // A partition with that box on one side passes the packet on untouched; otherwise one pass
+    // sorts the entries into front and back subsets, appended to 'packet' and removed when the
+    // children return, and a child whose bounds miss the box of its subset is skipped. Hits are
+    // stored in hits[entry.trace]
+    void traceSegments(const SegmentTrace *traces, Collision *hits, std::vector<PacketEntry> &packet,
+                       size_t first, size_t count, const BoundingBox &packetBounds) const;
+
+    // First contact of the moving sphere with the polygons of the subtree, see BSPTree::sweepSphere
+    SweepHit sweepSphere(const SphereSweep &sweep) const;
+
+    // sweepSphere for many spheres, hits[i] is the result for sweeps[i]
+    void sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits) const;
+
+    // Polygon of the subtree nearest to the point, if nearer than maxDistance, see BSPTree::nearestPolygon
+    NearestPolygon nearestPolygon(const Point3D &point, NType maxDistance) const;
+
+    // Append to 'result' the polygons of the subtree within 'radius' of the point
+    void polygonsWithinRadius(const Point3D &point, NType radius, std::vector<const Polygon *> &result) const;
+
+    // Append to 'result' the polygons of the subtree that are not fully behind any of the planes,
+    // see BSPTree::queryVolume
+    void queryVolume(const Plane *planes, size_t count, std::vector<const Polygon *> &result) const;
+
+    // Append to 'result' all the polygons of the subtree
+    void collectPolygons(std::vector<const Polygon *> &result) const;
 
     // Get number of polygons in the subtree
-    size_t getPolygonsCount() const {
-        size_t count = polygons.size();
-        if (front) {
-            count += front->getPolygonsCount();
-        }
-        if (back) {
-            count += back->getPolygonsCount();
-        }
-        return count;
-    }
+    size_t getPolygonsCount() const { return fragmentsCount; }
 };
 
 
 class BSPTree {
 private:
+    Arena arena;    // owns every node of the tree
     BSPNode *root;
 
+    bool solid;     // built by buildSolid: the cells of the tree are labelled inside / outside
+
+    // Polygons in the tree by id: the node of each of its fragments, so that remove and local
+    // rebuilds do not search the tree, and the polygon as given when the tree keeps them. All in
+    // the arena, and only once remove or a rebuild policy needs it
+    struct SourcePolygon {
+        using allocator_type = std::pmr::polymorphic_allocator<BSPNode *>;
+
+        const Polygon *polygon = nullptr;
+        std::pmr::vector<BSPNode *> nodes;
+
+        explicit SourcePolygon(const allocator_type &allocator = {}) : nodes(allocator) {}
+        SourcePolygon(const SourcePolygon &other, const allocator_type &allocator)
+                : polygon(other.polygon), nodes(other.nodes, allocator) {}
+        SourcePolygon(SourcePolygon &&other, const allocator_type &allocator)
+                : polygon(other.polygon), nodes(std::move(other.nodes), allocator) {}
+    };
+    using SourceMap = std::pmr::unordered_map<PolygonId, SourcePolygon>;
+    SourceMap *sources;         // nullptr until tracked, see trackSources
+    bool keepSources;           // copy the polygons given to insert and build, see setKeepSourcePolygons
+    size_t sourcePolygonsCount;
+    PolygonId nextId;
+    RebuildPolicy rebuildPolicy;
+    size_t rebuildsCount;
+
+    void prepareBuild(std::vector<Polygon> &polygons, BuildStats &stats);
+    void finishBuild();
+    void createSources();
+    void trackSources();
+    void registerFragments(BSPNode *subtree);
+    template <typename FragmentsOf>
+    void countSplitFragments(BSPNode *subtree, const FragmentsOf &fragmentsOf);
+    void replaceSubtree(BSPNode *old, BSPNode *replacement);
+    BSPNode *collapse(BSPNode *node);
+    bool isDegraded(const BSPNode *node) const;
+    void rebuildDegraded(const std::vector<BSPNode *> &changed);
+
+    // Bytes on the stack for the fragment nodes and the tagged copy of a polygon in insert
+    static constexpr size_t INSERT_BUFFER = 1024;
+    void rebuildSubtree(BSPNode *node);
+
+    // Number of points walked together by classifyPoints
+    static constexpr size_t POINTS_BLOCK = 4096;
+
+    // Sphere sweeps per task of the pool version of sweepSpheres
+    static constexpr size_t SWEEPS_BLOCK = 256;
+
 public:
-    BSPTree() : root(nullptr) {}
-    ~BSPTree() {
-        delete root;
-    }
+    BSPTree() : root(nullptr), solid(false), sources(nullptr), keepSources(false), sourcePolygonsCount(0), nextId(0),
+                rebuildsCount(0) {}
+    ~BSPTree() = default;
 
     // Getters
     BSPNode *getRoot() const { return root; }
+    Arena &getArena() { return arena; }
 //    size_t   getRootPolygonsCount() const { return root ? root->polygons.size() : 0; }
 
-    // Setters
+    // Setters (the nodes must be allocated from the arena of the tree)
     void setRoot(BSPNode *root) { this->root = root; }
 
-    // Insert a polygon into the tree
-    void insert(const Polygon &polygon);
+    // Insert a polygon into the tree. Returns its id, which all its fragments carry, or
+    // NO_POLYGON_ID when the polygon is degenerate and was not inserted. With a rebuild policy
+    // enabled a degraded subtree may be rebuilt, which invalidates the BSPNode and Polygon
+    // pointers into it
+    PolygonId insert(const Polygon &polygon);
+
+    // Remove all the fragments of an inserted polygon. Nodes left without polygons and with at most
+    // one child are collapsed, and with a rebuild policy enabled subtrees that degraded are rebuilt
+    // (see RebuildPolicy): both invalidate the BSPNode and Polygon pointers into them. The first
+    // remove walks the tree once to find the fragments by id. The memory of removed nodes and
+    // fragments stays in the arena until the next build. A solid tree stops being solid. False if
+    // there is no polygon with that id
+    bool remove(PolygonId id);
+
+    // Keep a copy of the polygons given to insert and build from now on (off by default), in the
+    // arena. Rebuilds then start over from them, which undoes their splits, instead of keeping
+    // the fragments
+    void setKeepSourcePolygons(bool keep);
+    bool getKeepSourcePolygons() const { return keepSources; }
+
+    // The polygon given to insert or build with that id, nullptr if there is none or it was not kept
+    const Polygon *getSourcePolygon(PolygonId id) const;
+
+    // Rebuild policy of insert and remove
+    const RebuildPolicy &getRebuildPolicy() const { return rebuildPolicy; }
+    void setRebuildPolicy(const RebuildPolicy &policy);
+    size_t getRebuildsCount() const { return rebuildsCount; }
+
+    // Polygons in the tree, as given (not split)
+    size_t getSourcePolygonsCount() const { return sourcePolygonsCount; }
+
+    // Replace the contents of the tree with a tree built from all the polygons at once,
+    // the partition of every node is chosen by 'selector' among the polygons that reach it.
+    // Polygon i of the input gets the id i
+    BuildStats build(std::vector<Polygon> polygons, const SplitterSelector &selector = balancedSplitter());
+
+    // Parallel version of build, same tree. Subtrees are built as tasks on 'pool' and the
+    // classification against each partition is a parallel pass, down to 'grainSize' polygons
+    BuildStats build(std::vector<Polygon> polygons, const SplitterSelector &selector, ThreadPool &pool,
+                     size_t grainSize = 4096);
+
+    // build for the boundary of a solid: closed, with the normals of the polygons pointing outwards.
+    // The empty cells of the tree are then inside (behind a partition) or outside (in front), which
+    // enables the point classification queries. Later inserts must keep the surface closed
+    BuildStats buildSolid(std::vector<Polygon> polygons, const SplitterSelector &selector = balancedSplitter());
+    BuildStats buildSolid(std::vector<Polygon> polygons, const SplitterSelector &selector, ThreadPool &pool,
+                          size_t grainSize = 4096);
+    bool isSolid() const { return solid; }
+
+    // Inside / outside / boundary of the solid, in O(depth). Throws if the tree is not solid
+    PointLocation classifyPoint(const Point3D &point) const;
+
+    // classifyPoint for many points, locations[i] is the result for points[i]. Blocks of points walk
+    // the tree together, with a vectorized plane test per node; the pool version spreads the blocks
+    void classifyPoints(const Point3D *points, size_t count, PointLocation *locations) const;
+    void classifyPoints(const Point3D *points, size_t count, PointLocation *locations, ThreadPool &pool) const;
+    std::vector<PointLocation> classifyPoints(const std::vector<Point3D> &points) const;
+
+    // Visit all the polygons in painter's order from 'eye', see BSPNode::traverse
+    template <typename Visitor>
+    bool traverse(const Point3D &eye, TraversalOrder order, Visitor &&visitor) const {
+        return root == nullptr || root->traverse(eye, order, std::forward<Visitor>(visitor));
+    }
+
+    // Polygons inside a convex volume (a view frustum, for instance) given as the planes that bound
+    // it, normals pointing inwards. Culling is conservative: a polygon is returned unless all its
+    // vertices are behind one of the planes. Subtrees whose bounds are behind a plane are skipped,
+    // subtrees whose bounds are inside all the planes are returned without testing their polygons.
+    // At most 64 planes
+    void queryVolume(const std::vector<Plane> &planes, std::vector<const Polygon *> &result) const;
+    std::vector<const Polygon *> queryVolume(const std::vector<Plane> &planes) const;
 
     // Detect collision with a line
-    const Polygon* detectCollision(const LineSegment& traceLine) const;
+    Collision detectCollision(const LineSegment& traceLine) const;
+
+    // Detect collisions for many lines at once, hits[i] is the result for traceLines[i]
+    void detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const;
+    std::vector<Collision> detectCollisions(const std::vector<LineSegment> &traceLines) const;
+
+    // The same for bundles of segments close to each other (rays from one eye through a window,
+    // for instance), walked in packets: each partition is tested once against the box of a packet
+    // that it leaves on one side. Keep the segments of a bundle consecutive. For scattered
+    // segments the packets only add work, use detectCollisions
+    void detectCoherentCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const;
+    std::vector<Collision> detectCoherentCollisions(const std::vector<LineSegment> &traceLines) const;
 
-    // Get number of polygons in the tree
+    // Polygon nearest to the point (snapping), or none if all are further than maxDistance. The walk
+    // visits the side of each partition the point is on first and the far side only while the
+    // distance to the partition is below the best distance found: the polygons there cannot be
+    // nearer. The polygons of a node lie on its partition, so they are skipped on the same test,
+    // and subtrees whose bounds are further away are skipped as well. Like the other queries the
+    // result is a fragment of the polygon given to the tree (same id)
+    NearestPolygon nearestPolygon(const Point3D &point,
+                                  NType maxDistance = std::numeric_limits<double>::infinity()) const;
+
+    // Polygons (fragments) within 'radius' of the point (sensing), with the same pruning at 'radius'
+    void polygonsWithinRadius(const Point3D &point, NType radius, std::vector<const Polygon *> &result) const;
+    std::vector<const Polygon *> polygonsWithinRadius(const Point3D &point, NType radius) const;
+
+    // Sweep a sphere along its motion (a character moving, for instance) and find the first polygon
+    // it touches. The descent is the one of detectCollision with every partition offset by the
+    // radius on both sides: a child is visited only for the part of the motion where the sphere
+    // reaches its side, and the polygons of a node only while the sphere touches their plane, so the
+    // cost stays logarithmic. Polygons the sphere already touches at the start stop it at time 0 if it
+    // moves towards their plane and are left out otherwise, so that a sphere resting on a floor can
+    // slide along it or leave it. A capsule between start and end overlaps a polygon exactly when the
+    // sweep hits it (or starts touching it)
+    SweepHit sweepSphere(const SphereSweep &sweep) const;
+
+    // sweepSphere for many moving spheres (the entities of a tick), hits[i] is the result for
+    // sweeps[i]; the pool version spreads the sweeps over the workers
+    void sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits) const;
+    void sweepSpheres(const SphereSweep *sweeps, size_t count, SweepHit *hits, ThreadPool &pool) const;
+    std::vector<SweepHit> sweepSpheres(const std::vector<SphereSweep> &sweeps) const;
+
+    // Number of polygons of the root node only
     size_t getRootPolygonsCount() const { return root ? root->getPolygons().size() : 0; }
 
+    // Number of polygons in the tree, fragments of split polygons included (from the root summary)
+    size_t getPolygonsCount() const { return root ? root->getPolygonsCount() : 0; }
+
+    // Shape and memory footprint of the tree, walking all the nodes. The bytes are those in use by
+    // the nodes, polygons and vertices (capacity of their arrays), not the blocks the arena holds
+    TreeStats stats() const;
+
     // Check if the tree is empty
     bool isEmpty() const { return root == nullptr; }
 };
 
+template <typename Visitor>
+bool BSPNode::traverse(const Point3D &eye, TraversalOrder order, Visitor &&visitor) const {
+    // Nodes still to walk. An expanded node only has its own polygons left: its children
+    // were pushed around it in the order they must be visited
+    struct Pending {
+        const BSPNode *node;
+        bool expanded;
+    };
+    std::vector<Pending> stack;
+    stack.reserve(64);
+    stack.push_back({this, false});
+    while (!stack.empty()) {
+        auto [node, expanded] = stack.back();
+        stack.pop_back();
+        if (expanded) {
+            // coplanar polygons in reverse as well, so that the two orders are exact reverses
+            size_t count = node->polygons.size();
+            for (size_t i = 0; i < count; ++i) {
+                const auto &polygon = node->polygons[order == BACK_TO_FRONT ? i : count - 1 - i];
+                if constexpr (std::is_void_v<std::invoke_result_t<Visitor &, const Polygon &>>) {
+                    visitor(polygon);
+                } else if (!visitor(polygon)) {
+                    return false;
+                }
+            }
+            continue;
+        }
+        // the side of the eye is the near one (the plane itself counts as the front)
+        bool eyeInFront = node->partition.distance(eye) >= 0;
+        const BSPNode *nearSide = eyeInFront ? node->front : node->back;
+        const BSPNode *farSide = eyeInFront ? node->back : node->front;
+        const BSPNode *first = order == BACK_TO_FRONT ? farSide : nearSide;
+        const BSPNode *last = order == BACK_TO_FRONT ? nearSide : farSide;
+        if (last != nullptr) {
+            stack.push_back({last, false});
+        }
+        stack.push_back({node, true});
+        if (first != nullptr) {
+            stack.push_back({first, false});
+        }
+    }
+    return true;
+}
+
 #endif // BSP_H
\ No newline at end of file
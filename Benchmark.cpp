@@ -0,0 +1,238 @@
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+#include "DataType.h"
+#include "Plane.h"
+#include "BSPTree.h"
+#include "Random.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifdef BSP_FAST_NUMERICS
+static const char *NTYPE_NAME = "Fast<double>";
+#else
+static const char *NTYPE_NAME = "Safe<double>";
+#endif
+
+// Seeded input so that both numeric policies build the very same tree
+static std::vector<Polygon> benchmarkPolygons(int n) {
+    seedRandom(42);
+    return generateRandomPolygons(n, 0, 500, 0, 500, 0, 500);
+}
+
+// Input distributions of the macro benchmarks (first argument)
+enum Distribution { UNIFORM = 0, CLUSTERED = 1 };
+
+static const char *distributionName(int64_t distribution) {
+    return distribution == UNIFORM ? "uniform" : "clustered";
+}
+
+// n polygons in a box whose side grows with the cube root of n, so that the density stays the
+// same across sizes: uniform, or around n / 100 + 1 centers. Generated once per (distribution, n)
+static const std::vector<Polygon> &macroPolygons(int64_t distribution, int64_t n) {
+    static std::map<std::pair<int64_t, int64_t>, std::vector<Polygon>> cache;
+    auto &polygons = cache[{distribution, n}];
+    if (polygons.empty()) {
+        float side = 10 * std::cbrt(static_cast<float>(n));
+        seedRandom(distribution == UNIFORM ? 42 : 43);
+        polygons = distribution == UNIFORM
+                   ? generateRandomPolygons(static_cast<int>(n), 0, side, 0, side, 0, side)
+                   : generateClusteredPolygons(static_cast<int>(n), static_cast<int>(n / 100 + 1), side / 50,
+                                               0, side, 0, side, 0, side);
+    }
+    return polygons;
+}
+
+// Regular polygon of 'vertices' vertices and radius 1 around 'center', on a random plane
+static Polygon regularPolygon(int vertices, const Point3D &center) {
+    auto [u, w] = generateOrthogonalVectors(randomUnitVector());
+    std::vector<Point3D> points;
+    for (int i = 0; i < vertices; ++i) {
+        double angle = 2 * M_PI * i / vertices;
+        points.push_back(center + u * std::cos(angle) + w * std::sin(angle));
+    }
+    return Polygon(points);
+}
+
+// Pairs of a polygon of 'vertices' vertices and a plane through a random point near its center:
+// mostly polygons cut by the plane, some on one side
+static std::vector<std::pair<Polygon, Plane>> polygonPlanePairs(int vertices) {
+    seedRandom(7);
+    std::vector<std::pair<Polygon, Plane>> pairs;
+    for (int i = 0; i < 1024; ++i) {
+        Point3D center = randomPointInBox(0, 100, 0, 100, 0, 100);
+        Polygon polygon = regularPolygon(vertices, center);
+        Point3D through = center + Vector3D(randomPointInBox(-1, 1, -1, 1, -1, 1));
+        pairs.emplace_back(std::move(polygon), Plane(through, randomUnitVector()));
+    }
+    return pairs;
+}
+
+// Micro benchmarks, by number of vertices of the polygons
+
+static void BM_RelationWithPlane(benchmark::State &state) {
+    auto pairs = polygonPlanePairs(static_cast<int>(state.range(0)));
+    size_t i = 0;
+    for (auto _: state) {
+        const auto &[polygon, plane] = pairs[i++ % pairs.size()];
+        benchmark::DoNotOptimize(polygon.relationWithPlane(plane));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_RelationWithPlane)->RangeMultiplier(2)->Range(3, 48);
+
+static void BM_PolygonSplit(benchmark::State &state) {
+    auto pairs = polygonPlanePairs(static_cast<int>(state.range(0)));
+    SplitBuffer parts;
+    size_t i = 0;
+    for (auto _: state) {
+        const auto &[polygon, plane] = pairs[i++ % pairs.size()];
+        parts.split(polygon, plane);
+        benchmark::DoNotOptimize(parts.front.getVertices().data());
+        benchmark::DoNotOptimize(parts.back.getVertices().data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_PolygonSplit)->RangeMultiplier(2)->Range(3, 48);
+
+static void BM_PlaneIntersect(benchmark::State &state) {
+    seedRandom(11);
+    std::vector<std::pair<Plane, Line>> pairs;
+    for (int i = 0; i < 1024; ++i) {
+        Plane plane(randomPointInBox(0, 100, 0, 100, 0, 100), randomUnitVector());
+        pairs.emplace_back(plane, Line(randomPointInBox(0, 100, 0, 100, 0, 100), randomUnitVector()));
+    }
+    size_t i = 0;
+    for (auto _: state) {
+        const auto &[plane, line] = pairs[i++ % pairs.size()];
+        benchmark::DoNotOptimize(plane.intersect(line));
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_PlaneIntersect);
+
+// Macro benchmarks: (distribution, polygons), 10^3 to 10^6 polygons
+
+static void BM_Build(benchmark::State &state) {
+    const auto &polygons = macroPolygons(state.range(0), state.range(1));
+    BuildStats stats;
+    for (auto _: state) {
+        BSPTree tree;
+        stats = tree.build(polygons);
+        benchmark::DoNotOptimize(tree.getRoot());
+    }
+    state.counters["depth"] = static_cast<double>(stats.depth);
+    state.counters["fragments"] = static_cast<double>(stats.polygons);
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+    state.SetLabel(std::string(NTYPE_NAME) + " " + distributionName(state.range(0)));
+}
+BENCHMARK(BM_Build)->ArgsProduct({{UNIFORM, CLUSTERED}, {1000, 10000, 100000, 1000000}})
+        ->Unit(benchmark::kMillisecond);
+
+// Segments of the segment queries (fourth argument): scattered, about a tenth of the box long
+// each, or a bundle of 64 x 64 from one eye through a narrow window, half the box long, in
+// 16 x 16 tiles so that every packet is one tile
+enum SegmentShape { SCATTERED = 0, BUNDLE = 1 };
+
+static std::vector<LineSegment> benchmarkSegments(int64_t shape, float side) {
+    std::vector<LineSegment> segments;
+    if (shape == SCATTERED) {
+        seedRandom(5);
+        for (int i = 0; i < 4096; ++i) {
+            Point3D start = randomPointInBox(0, side, 0, side, 0, side);
+            segments.emplace_back(start, start + randomUnitVector() * (side / 10));
+        }
+        return segments;
+    }
+    Point3D eye(side / 20, side / 2, side / 2);
+    for (int tile = 0; tile < 16; ++tile) {
+        for (int i = 0; i < 256; ++i) {
+            int row = (tile / 4) * 16 + i / 16, column = (tile % 4) * 16 + i % 16;
+            Vector3D direction(1, (row - 31.5) / 128, (column - 31.5) / 128);
+            segments.emplace_back(eye, eye + direction.unit() * (side / 2));
+        }
+    }
+    return segments;
+}
+
+// First hit of each segment: one at a time (0) or in packets (1, detectCoherentCollisions)
+static void BM_SegmentQueries(benchmark::State &state) {
+    const auto &polygons = macroPolygons(state.range(0), state.range(1));
+    BSPTree tree;
+    tree.build(polygons);
+    float side = 10 * std::cbrt(static_cast<float>(state.range(1)));
+    std::vector<LineSegment> segments = benchmarkSegments(state.range(3), side);
+    std::vector<Collision> hits(segments.size());
+    for (auto _: state) {
+        if (state.range(2) == 0) {
+            for (size_t i = 0; i < segments.size(); ++i) {
+                hits[i] = tree.detectCollision(segments[i]);
+            }
+        } else {
+            tree.detectCoherentCollisions(segments.data(), segments.size(), hits.data());
+        }
+        benchmark::DoNotOptimize(hits.data());
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(segments.size()));
+    state.SetLabel(std::string(NTYPE_NAME) + " " + distributionName(state.range(0))
+                   + (state.range(3) == SCATTERED ? " scattered" : " bundle"));
+}
+BENCHMARK(BM_SegmentQueries)->ArgsProduct({{UNIFORM, CLUSTERED}, {1000, 10000, 100000, 1000000}, {0, 1},
+                                           {SCATTERED, BUNDLE}})
+        ->Unit(benchmark::kMicrosecond);
+
+// Tree build: relationWithPlane, split and the plane math behind them
+static void BM_BuildTree(benchmark::State &state) {
+    auto polygons = benchmarkPolygons(static_cast<int>(state.range(0)));
+    for (auto _: state) {
+        BSPTree tree;
+        for (const auto &polygon: polygons) {
+            tree.insert(polygon);
+        }
+        benchmark::DoNotOptimize(tree.getRoot());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_BuildTree)->RangeMultiplier(4)->Range(1 << 10, 1 << 14)->Unit(benchmark::kMillisecond);
+
+// Bulk build with each splitter selector: 0 first polygon, 1 balanced, 2 surface area
+static void BM_BuildHeuristic(benchmark::State &state) {
+    auto polygons = benchmarkPolygons(static_cast<int>(state.range(1)));
+    SplitterSelector selectors[] = {firstPolygonSplitter(), balancedSplitter(), surfaceAreaSplitter()};
+    BuildStats stats;
+    for (auto _: state) {
+        BSPTree tree;
+        stats = tree.build(polygons, selectors[state.range(0)]);
+        benchmark::DoNotOptimize(tree.getRoot());
+    }
+    state.counters["depth"] = static_cast<double>(stats.depth);
+    state.counters["fragments"] = static_cast<double>(stats.polygons);
+    state.counters["splits"] = static_cast<double>(stats.splits);
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_BuildHeuristic)->ArgsProduct({{0, 1, 2}, {1 << 10, 1 << 13}})->Unit(benchmark::kMillisecond);
+
+// Scaling of the parallel build with the number of threads
+static void BM_ParallelBuild(benchmark::State &state) {
+    auto polygons = benchmarkPolygons(static_cast<int>(state.range(1)));
+    ThreadPool pool(static_cast<size_t>(state.range(0)));
+    for (auto _: state) {
+        BSPTree tree;
+        tree.build(polygons, balancedSplitter(), pool, 1024);
+        benchmark::DoNotOptimize(tree.getRoot());
+    }
+    state.counters["threads"] = static_cast<double>(state.range(0));
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+    state.SetLabel(NTYPE_NAME);
+}
+BENCHMARK(BM_ParallelBuild)->ArgsProduct({{1, 2, 4, 8}, {1 << 17}})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
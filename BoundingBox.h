@@ -0,0 +1,116 @@
+#ifndef BOUNDING_BOX_H
+#define BOUNDING_BOX_H
+
+#include "Point.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+// Axis aligned bounding box on raw doubles. A default constructed box is empty (min > max)
+// and extending it with anything yields that thing's box
+struct BoundingBox {
+    double min[3] = {std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(),
+                     std::numeric_limits<double>::infinity()};
+    double max[3] = {-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+                     -std::numeric_limits<double>::infinity()};
+
+    bool isEmpty() const { return min[0] > max[0]; }
+
+    void extend(const Point3D &p) {
+        const double coordinates[3] = {p.getX().getValue(), p.getY().getValue(), p.getZ().getValue()};
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], coordinates[i]);
+            max[i] = std::max(max[i], coordinates[i]);
+        }
+    }
+
+    void extend(const double point[3]) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], point[i]);
+            max[i] = std::max(max[i], point[i]);
+        }
+    }
+
+    void extend(const BoundingBox &other) {
+        for (int i = 0; i < 3; ++i) {
+            min[i] = std::min(min[i], other.min[i]);
+            max[i] = std::max(max[i], other.max[i]);
+        }
+    }
+
+    // Smallest and largest signed distance of the box to the plane (nx, ny, nz, d): the corners
+    // nearest to the back and to the front of the plane
+    double minDistance(const double plane[4]) const {
+        double distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] > 0 ? min[i] : max[i]);
+        }
+        return distance;
+    }
+
+    double maxDistance(const double plane[4]) const {
+        double distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] > 0 ? max[i] : min[i]);
+        }
+        return distance;
+    }
+
+    // Distance from the point to the box, 0 inside it and infinite for an empty box
+    double distance(const double point[3]) const {
+        double squared = 0;
+        for (int i = 0; i < 3; ++i) {
+            double outside = std::max(std::max(min[i] - point[i], point[i] - max[i]), 0.0);
+            squared += outside * outside;
+        }
+        return std::sqrt(squared);
+    }
+
+    // Do the boxes overlap once this one is grown by 'margin'? False if either is empty
+    bool overlaps(const BoundingBox &other, double margin) const {
+        for (int i = 0; i < 3; ++i) {
+            if (other.max[i] < min[i] - margin || other.min[i] > max[i] + margin) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The part of this box inside 'other' grown by 'margin'
+    BoundingBox clippedTo(const BoundingBox &other, double margin) const {
+        BoundingBox clipped;
+        for (int i = 0; i < 3; ++i) {
+            clipped.min[i] = std::max(min[i], other.min[i] - margin);
+            clipped.max[i] = std::min(max[i], other.max[i] + margin);
+        }
+        return clipped;
+    }
+
+    // Slab test: does origin + t * direction, t in [tMin, tMax], touch the box grown by 'margin'?
+    bool intersectsSegment(const double origin[3], const double direction[3], double tMin, double tMax,
+                           double margin) const {
+        for (int i = 0; i < 3; ++i) {
+            double low = min[i] - margin, high = max[i] + margin;
+            if (direction[i] == 0) {
+                if (origin[i] < low || origin[i] > high) {
+                    return false;
+                }
+                continue;
+            }
+            double tLow = (low - origin[i]) / direction[i];
+            double tHigh = (high - origin[i]) / direction[i];
+            if (tLow > tHigh) {
+                std::swap(tLow, tHigh);
+            }
+            tMin = std::max(tMin, tLow);
+            tMax = std::min(tMax, tHigh);
+            if (tMin > tMax) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // BOUNDING_BOX_H
@@ -0,0 +1,184 @@
+#include "CSG.h"
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+std::vector<Polygon> polygonsOf(const BSPTree &tree) {
+    if (!tree.isSolid()) {
+        throw std::runtime_error("csg needs trees built by buildSolid");
+    }
+    std::vector<const Polygon *> stored;
+    if (tree.getRoot() != nullptr) {
+        tree.getRoot()->collectPolygons(stored);
+    }
+    std::vector<Polygon> polygons;
+    polygons.reserve(stored.size());
+    for (const Polygon *polygon: stored) {
+        polygons.emplace_back(*polygon);
+    }
+    return polygons;
+}
+
+std::vector<Polygon> flipped(std::vector<Polygon> polygons) {
+    for (auto &polygon: polygons) {
+        polygon.flip();
+    }
+    return polygons;
+}
+
+void append(std::vector<Polygon> &to, std::vector<Polygon> &&from) {
+    std::move(from.begin(), from.end(), std::back_inserter(to));
+}
+
+// Runs both functions, at the same time if there is a pool
+template <typename First, typename Second>
+void runBoth(ThreadPool *pool, const First &first, const Second &second) {
+    if (pool == nullptr) {
+        first();
+        second();
+        return;
+    }
+    TaskGroup group(*pool);
+    group.run(first);
+    second();
+    group.wait();
+}
+
+BuildStats runCSG(CSGOperation operation, const BSPTree &a, const BSPTree &b, BSPTree &result, ThreadPool *pool,
+                  const SplitterSelector &selector) {
+    std::vector<Polygon> polygonsA = polygonsOf(a), polygonsB = polygonsOf(b);
+    const BSPNode *treeA = a.getRoot(), *treeB = b.getRoot();
+
+    // the sequences of clipTo and invert of the classic algorithm, without touching the operands:
+    // an inverted tree is walked with the inverted flag, inverted polygons are flipped copies
+    std::vector<Polygon> clippedA, clippedB, polygons;
+    switch (operation) {
+        case CSG_UNION:
+            // A outside B, B outside A, and of B what is on a shared face turned around, once
+            runBoth(pool, [&] { clippedA = clipPolygons(treeB, false, std::move(polygonsA), pool); },
+                    [&] { clippedB = clipPolygons(treeA, false, std::move(polygonsB), pool); });
+            polygons = std::move(clippedA);
+            append(polygons, flipped(clipPolygons(treeA, false, flipped(std::move(clippedB)), pool)));
+            break;
+        case CSG_INTERSECTION:
+            // A inside B and B inside A, through the inverted trees
+            runBoth(pool, [&] { clippedA = clipPolygons(treeB, true, flipped(std::move(polygonsA)), pool); },
+                    [&] { clippedB = clipPolygons(treeA, true, std::move(polygonsB), pool); });
+            polygons = flipped(std::move(clippedA));
+            append(polygons, flipped(clipPolygons(treeA, true, flipped(std::move(clippedB)), pool)));
+            break;
+        case CSG_DIFFERENCE:
+            // A outside B, and B inside A turned around (the walls of the hole)
+            runBoth(pool, [&] { clippedA = clipPolygons(treeB, false, flipped(std::move(polygonsA)), pool); },
+                    [&] { clippedB = clipPolygons(treeA, true, std::move(polygonsB), pool); });
+            polygons = flipped(std::move(clippedA));
+            append(polygons, clipPolygons(treeA, true, flipped(std::move(clippedB)), pool));
+            break;
+    }
+    return pool != nullptr ? result.buildSolid(std::move(polygons), selector, *pool)
+                           : result.buildSolid(std::move(polygons), selector);
+}
+
+} // namespace
+
+std::vector<Polygon> clipPolygons(const BSPNode *node, bool inverted, std::vector<Polygon> polygons,
+                                  ThreadPool *pool) {
+    // an empty tree is all outside, its inversion all inside
+    if (node == nullptr) {
+        return inverted ? std::vector<Polygon>() : polygons;
+    }
+    Plane partition = node->getPartition();
+    if (inverted) {
+        partition = Plane(partition.getPoint(), -partition.getNormal());
+    }
+    const BSPNode *frontChild = inverted ? node->getBack() : node->getFront();
+    const BSPNode *backChild = inverted ? node->getFront() : node->getBack();
+
+    std::vector<Polygon> front, back;
+    SplitBuffer parts;
+    for (const auto &polygon: polygons) {
+        switch (polygon.relationWithPlane(partition)) {
+            case COINCIDENT:
+                (polygon.getNormal().dotProduct(partition.getNormal()) > 0 ? front : back).push_back(polygon);
+                break;
+            case IN_FRONT:
+                front.push_back(polygon);
+                break;
+            case BEHIND:
+                back.push_back(polygon);
+                break;
+            case SPLIT:
+                parts.split(polygon, partition);
+                if (!parts.front.isDegenerate()) {
+                    front.push_back(parts.front);
+                }
+                if (!parts.back.isDegenerate()) {
+                    back.push_back(parts.back);
+                }
+                break;
+        }
+    }
+    polygons.clear();
+    polygons.shrink_to_fit();
+
+    // behind a missing back child is solid: those parts are gone
+    if (backChild == nullptr) {
+        back.clear();
+    }
+    auto clipFront = [&] {
+        if (frontChild != nullptr && !front.empty()) {
+            front = clipPolygons(frontChild, inverted, std::move(front), pool);
+        }
+    };
+    auto clipBack = [&] {
+        if (backChild != nullptr && !back.empty()) {
+            back = clipPolygons(backChild, inverted, std::move(back), pool);
+        }
+    };
+    runBoth(front.size() + back.size() >= CSG_GRAIN ? pool : nullptr, clipFront, clipBack);
+    append(front, std::move(back));
+    return front;
+}
+
+BuildStats csg(CSGOperation operation, const BSPTree &a, const BSPTree &b, BSPTree &result,
+               const SplitterSelector &selector) {
+    return runCSG(operation, a, b, result, nullptr, selector);
+}
+
+BuildStats csg(CSGOperation operation, const BSPTree &a, const BSPTree &b, BSPTree &result, ThreadPool &pool,
+               const SplitterSelector &selector) {
+    return runCSG(operation, a, b, result, &pool, selector);
+}
+
+BuildStats csgUnion(const std::vector<const BSPTree *> &trees, BSPTree &result, ThreadPool &pool,
+                    const SplitterSelector &selector) {
+    if (trees.size() <= 1) {
+        return result.buildSolid(trees.empty() ? std::vector<Polygon>() : polygonsOf(*trees.front()), selector, pool);
+    }
+    // every level unions the pairs of the previous one, the last pair goes into 'result'
+    std::vector<const BSPTree *> level = trees;
+    std::vector<std::unique_ptr<BSPTree>> intermediate;
+    while (level.size() > 2) {
+        std::vector<const BSPTree *> next;
+        TaskGroup group(pool);
+        for (size_t i = 0; i < level.size(); i += 2) {
+            if (i + 1 == level.size()) {
+                next.push_back(level[i]);
+                continue;
+            }
+            intermediate.push_back(std::make_unique<BSPTree>());
+            BSPTree *merged = intermediate.back().get();
+            next.push_back(merged);
+            const BSPTree *first = level[i], *second = level[i + 1];
+            group.run([first, second, merged, &pool, &selector] {
+                csg(CSG_UNION, *first, *second, *merged, pool, selector);
+            });
+        }
+        group.wait();
+        level = std::move(next);
+    }
+    return csg(CSG_UNION, *level[0], *level[1], result, pool, selector);
+}
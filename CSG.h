@@ -0,0 +1,44 @@
+#ifndef CSG_H
+#define CSG_H
+
+#include "DataType.h"
+#include "Plane.h"
+#include "BSPTree.h"
+#include "ThreadPool.h"
+#include <vector>
+
+// Boolean operations between solids given as trees built by BSPTree::buildSolid (closed surfaces,
+// normals pointing outwards). The polygons of each operand are clipped against the partitions of
+// the other tree, with Polygon::relationWithPlane and split: what falls in an empty cell is outside
+// that solid, what falls behind a missing back child is inside. Coplanar polygons go to the side
+// their normal faces. Clipping against the inverted tree (planes turned around, front and back
+// swapped) keeps the parts outside instead, and coplanar faces shared by both operands are kept once.
+// The surviving polygons are built into 'result' with buildSolid.
+//
+// With a pool, the two operands are clipped at the same time and the front and back sides of every
+// partition are clipped as separate tasks, down to CSG_GRAIN polygons, and the result is built with
+// the parallel build. Throws std::runtime_error if an operand is not solid.
+
+enum CSGOperation {
+    CSG_UNION,          // a or b
+    CSG_INTERSECTION,   // a and b
+    CSG_DIFFERENCE      // a and not b
+};
+
+constexpr size_t CSG_GRAIN = 256;
+
+BuildStats csg(CSGOperation operation, const BSPTree &a, const BSPTree &b, BSPTree &result,
+               const SplitterSelector &selector = balancedSplitter());
+BuildStats csg(CSGOperation operation, const BSPTree &a, const BSPTree &b, BSPTree &result, ThreadPool &pool,
+               const SplitterSelector &selector = balancedSplitter());
+
+// Union of many solids (brushes): pairwise unions as a balanced reduction, the independent pairs
+// of each level run in parallel
+BuildStats csgUnion(const std::vector<const BSPTree *> &trees, BSPTree &result, ThreadPool &pool,
+                    const SplitterSelector &selector = balancedSplitter());
+
+// The parts of 'polygons' outside the solid of the subtree (inside, if 'inverted')
+std::vector<Polygon> clipPolygons(const BSPNode *node, bool inverted, std::vector<Polygon> polygons,
+                                  ThreadPool *pool = nullptr);
+
+#endif // CSG_H
@@ -0,0 +1,222 @@
+#include "Classification.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BSP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using DistancesKernel = void (*)(const double *, size_t, const double *, double *);
+using MasksKernel = void (*)(const double *, size_t, const double *, double, uint64_t *, uint64_t *);
+
+struct Kernels {
+    const char *name;
+    DistancesKernel distances;
+    MasksKernel masks;
+};
+
+inline double scalarDistance(const double *v, const double plane[4]) {
+    return plane[0] * v[0] + plane[1] * v[1] + plane[2] * v[2] + plane[3];
+}
+
+inline void setBits(uint64_t *mask, size_t first, uint64_t bits) {
+    mask[first / 64] |= bits << (first % 64);
+}
+
+void distancesScalar(const double *xyz, size_t count, const double *plane, double *distances) {
+    for (size_t i = 0; i < count; ++i) {
+        distances[i] = scalarDistance(xyz + 3 * i, plane);
+    }
+}
+
+#ifndef BSP_X86_KERNELS
+
+void masksScalar(const double *xyz, size_t count, const double *plane, double epsilon,
+                 uint64_t *frontMask, uint64_t *backMask) {
+    for (size_t i = 0; i < count; ++i) {
+        double distance = scalarDistance(xyz + 3 * i, plane);
+        setBits(frontMask, i, distance > epsilon ? 1 : 0);
+        setBits(backMask, i, distance < -epsilon ? 1 : 0);
+    }
+}
+
+#endif // BSP_X86_KERNELS
+
+#ifdef BSP_X86_KERNELS
+
+// SSE2: two vertices per iteration
+inline __m128d distancesSSE2Block(const double *v, const double *plane) {
+    __m128d x = _mm_setr_pd(v[0], v[3]);
+    __m128d y = _mm_setr_pd(v[1], v[4]);
+    __m128d z = _mm_setr_pd(v[2], v[5]);
+    __m128d xy = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(plane[0]), x), _mm_mul_pd(_mm_set1_pd(plane[1]), y));
+    return _mm_add_pd(_mm_add_pd(xy, _mm_mul_pd(_mm_set1_pd(plane[2]), z)), _mm_set1_pd(plane[3]));
+}
+
+void distancesSSE2(const double *xyz, size_t count, const double *plane, double *distances) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(distances + i, distancesSSE2Block(xyz + 3 * i, plane));
+    }
+    distancesScalar(xyz + 3 * i, count - i, plane, distances + i);
+}
+
+void masksSSE2(const double *xyz, size_t count, const double *plane, double epsilon,
+               uint64_t *frontMask, uint64_t *backMask) {
+    const __m128d positive = _mm_set1_pd(epsilon);
+    const __m128d negative = _mm_set1_pd(-epsilon);
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d distance = distancesSSE2Block(xyz + 3 * i, plane);
+        setBits(frontMask, i, static_cast<uint64_t>(_mm_movemask_pd(_mm_cmpgt_pd(distance, positive))));
+        setBits(backMask, i, static_cast<uint64_t>(_mm_movemask_pd(_mm_cmplt_pd(distance, negative))));
+    }
+    for (; i < count; ++i) {
+        double distance = scalarDistance(xyz + 3 * i, plane);
+        setBits(frontMask, i, distance > epsilon ? 1 : 0);
+        setBits(backMask, i, distance < -epsilon ? 1 : 0);
+    }
+}
+
+// AVX2: four vertices per iteration, gathered from the x, y, z triples. The last, partial
+// block uses masked gathers so that triangles are a single iteration as well
+__attribute__((target("avx2,fma")))
+inline __m256d distancesAVX2Block(const double *v, size_t lanes, const double *plane) {
+    const __m256i index = _mm256_setr_epi64x(0, 3, 6, 9);
+    __m256d x, y, z;
+    if (lanes == 4) {
+        x = _mm256_i64gather_pd(v, index, 8);
+        y = _mm256_i64gather_pd(v + 1, index, 8);
+        z = _mm256_i64gather_pd(v + 2, index, 8);
+    } else {
+        __m256d active = _mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(static_cast<long long>(lanes)),
+                                                                 _mm256_setr_epi64x(0, 1, 2, 3)));
+        x = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), v, index, active, 8);
+        y = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), v + 1, index, active, 8);
+        z = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), v + 2, index, active, 8);
+    }
+    __m256d distance = _mm256_fmadd_pd(_mm256_set1_pd(plane[2]), z, _mm256_set1_pd(plane[3]));
+    distance = _mm256_fmadd_pd(_mm256_set1_pd(plane[1]), y, distance);
+    return _mm256_fmadd_pd(_mm256_set1_pd(plane[0]), x, distance);
+}
+
+__attribute__((target("avx2,fma")))
+void distancesAVX2(const double *xyz, size_t count, const double *plane, double *distances) {
+    for (size_t i = 0; i < count; i += 4) {
+        size_t lanes = std::min<size_t>(4, count - i);
+        __m256d distance = distancesAVX2Block(xyz + 3 * i, lanes, plane);
+        if (lanes == 4) {
+            _mm256_storeu_pd(distances + i, distance);
+        } else {
+            alignas(32) double block[4];
+            _mm256_store_pd(block, distance);
+            std::copy(block, block + lanes, distances + i);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void masksAVX2(const double *xyz, size_t count, const double *plane, double epsilon,
+               uint64_t *frontMask, uint64_t *backMask) {
+    const __m256d positive = _mm256_set1_pd(epsilon);
+    const __m256d negative = _mm256_set1_pd(-epsilon);
+    for (size_t i = 0; i < count; i += 4) {
+        size_t lanes = std::min<size_t>(4, count - i);
+        uint64_t active = (uint64_t(1) << lanes) - 1;
+        __m256d distance = distancesAVX2Block(xyz + 3 * i, lanes, plane);
+        auto front = static_cast<uint64_t>(_mm256_movemask_pd(_mm256_cmp_pd(distance, positive, _CMP_GT_OQ)));
+        auto back = static_cast<uint64_t>(_mm256_movemask_pd(_mm256_cmp_pd(distance, negative, _CMP_LT_OQ)));
+        setBits(frontMask, i, front & active);
+        setBits(backMask, i, back & active);
+    }
+}
+
+#endif // BSP_X86_KERNELS
+
+Kernels pickKernels() {
+#ifdef BSP_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return {"avx2", distancesAVX2, masksAVX2};
+    }
+    return {"sse2", distancesSSE2, masksSSE2};
+#else
+    return {"scalar", distancesScalar, masksScalar};
+#endif
+}
+
+const Kernels &kernels() {
+    static const Kernels picked = pickKernels();
+    return picked;
+}
+
+RelationType relationFromCounts(size_t frontCount, size_t backCount) {
+    if (frontCount == 0 && backCount == 0) {
+        return COINCIDENT;
+    } else if (backCount == 0) {
+        return IN_FRONT;
+    } else if (frontCount == 0) {
+        return BEHIND;
+    } else {
+        return SPLIT;
+    }
+}
+
+// Number of set bits of mask in [first, last)
+size_t countBits(const uint64_t *mask, size_t first, size_t last) {
+    size_t count = 0;
+    while (first < last) {
+        size_t bit = first % 64;
+        size_t bits = std::min<size_t>(64 - bit, last - first);
+        uint64_t word = mask[first / 64] >> bit;
+        if (bits < 64) {
+            word &= (uint64_t(1) << bits) - 1;
+        }
+        count += static_cast<size_t>(__builtin_popcountll(word));
+        first += bits;
+    }
+    return count;
+}
+
+} // namespace
+
+void planeDistances(const double *xyz, size_t count, const double plane[4], double *distances) {
+    kernels().distances(xyz, count, plane, distances);
+}
+
+void classifyVertices(const double *xyz, size_t count, const double plane[4], double epsilon,
+                      uint64_t *frontMask, uint64_t *backMask) {
+    std::fill(frontMask, frontMask + (count + 63) / 64, 0);
+    std::fill(backMask, backMask + (count + 63) / 64, 0);
+    kernels().masks(xyz, count, plane, epsilon, frontMask, backMask);
+}
+
+RelationType classifyPolygon(const double *xyz, size_t count, const double plane[4], double epsilon) {
+    // one word per side for the usual polygons, without touching the heap
+    if (count <= 64) {
+        uint64_t frontMask = 0, backMask = 0;
+        kernels().masks(xyz, count, plane, epsilon, &frontMask, &backMask);
+        return relationFromCounts(frontMask != 0, backMask != 0);
+    }
+    std::vector<uint64_t> frontMask((count + 63) / 64), backMask((count + 63) / 64);
+    classifyVertices(xyz, count, plane, epsilon, frontMask.data(), backMask.data());
+    return relationFromCounts(countBits(frontMask.data(), 0, count), countBits(backMask.data(), 0, count));
+}
+
+void classifyPolygons(const double *xyz, const uint32_t *offsets, size_t polygonCount, const double plane[4],
+                      double epsilon, RelationType *relations) {
+    size_t count = offsets[polygonCount];
+    std::vector<uint64_t> frontMask((count + 63) / 64), backMask((count + 63) / 64);
+    classifyVertices(xyz, count, plane, epsilon, frontMask.data(), backMask.data());
+    for (size_t i = 0; i < polygonCount; ++i) {
+        relations[i] = relationFromCounts(countBits(frontMask.data(), offsets[i], offsets[i + 1]),
+                                          countBits(backMask.data(), offsets[i], offsets[i + 1]));
+    }
+}
+
+const char *classificationKernel() {
+    return kernels().name;
+}
@@ -0,0 +1,45 @@
+#ifndef CLASSIFICATION_H
+#define CLASSIFICATION_H
+
+#include "DataType.h"
+#include "Point.h"
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Vectorized plane-vs-vertex kernels (AVX2 or SSE2 when the CPU has them, scalar otherwise).
+// Vertices are x, y, z triples of doubles, planes are packed as (nx, ny, nz, d) and the signed
+// distance of v is n·v + d. A vertex is in front when its distance is > epsilon, behind when it
+// is < -epsilon and on the plane otherwise, as with the Safe<double> comparisons.
+
+// Same tolerance as Safe<double>
+constexpr double CLASSIFY_EPSILON = 1e-6;
+
+// Point3D is three NType, which are a single double each: an array of Point3D is an array of x, y, z
+static_assert(sizeof(NType) == sizeof(double) && sizeof(Point3D) == 3 * sizeof(double) &&
+              std::is_standard_layout<Point3D>::value, "Point3D must be three packed doubles");
+
+inline const double *vertexData(const Point3D *points) {
+    return reinterpret_cast<const double *>(points);
+}
+
+// distances[i] = n·v[i] + d
+void planeDistances(const double *xyz, size_t count, const double plane[4], double *distances);
+
+// Bit i of frontMask / backMask is set when vertex i is in front of / behind the plane.
+// Both masks hold (count + 63) / 64 words
+void classifyVertices(const double *xyz, size_t count, const double plane[4], double epsilon,
+                      uint64_t *frontMask, uint64_t *backMask);
+
+// Relation of one polygon (its vertices) with the plane, same rules as Polygon::relationWithPlane
+RelationType classifyPolygon(const double *xyz, size_t count, const double plane[4], double epsilon);
+
+// Relation of many polygons of a vertex pool with one plane, in a single pass over the pool.
+// Polygon i has the vertices [offsets[i], offsets[i + 1])
+void classifyPolygons(const double *xyz, const uint32_t *offsets, size_t polygonCount, const double plane[4],
+                      double epsilon, RelationType *relations);
+
+// Name of the kernel picked for this CPU ("avx2", "sse2" or "scalar")
+const char *classificationKernel();
+
+#endif // CLASSIFICATION_H
@@ -0,0 +1,367 @@
+#include "CompiledBSPTree.h"
+#include "QueryCounters.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template <typename Scalar>
+struct BasicCompiledBSPTree<Scalar>::Arrays {
+    std::vector<Node> nodes;
+    std::vector<PolygonRecord> polygons;
+    std::vector<Scalar> vertices;
+};
+
+namespace {
+
+constexpr char MAGIC[8] = "BSPTREE";
+constexpr uint32_t BYTE_ORDER_MARK = 0x01020304u;
+constexpr uint64_t SECTION_ALIGNMENT = 64;
+
+uint64_t alignSection(uint64_t offset) {
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+// Read-only mapping of a whole file, unmapped with its last owner
+class MappedFile {
+private:
+    void *address;
+    size_t size;
+
+public:
+    explicit MappedFile(const std::string &path) : address(MAP_FAILED), size(0) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat status{};
+        if (::fstat(fd, &status) != 0 || status.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map empty or unreadable file " + path);
+        }
+        size = static_cast<size_t>(status.st_size);
+        address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Cannot map " + path);
+        }
+    }
+
+    ~MappedFile() {
+        if (address != MAP_FAILED) {
+            ::munmap(address, size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return static_cast<const char *>(address); }
+    size_t getSize() const { return size; }
+};
+
+// Packed plane (n, d) with a unit normal, rounded to the scalar of the tree. Grows 'extent' to the offset
+template <typename Scalar>
+void packPlane(const Plane &plane, Scalar out[4], double &extent) {
+    std::transform(plane.getEquation(), plane.getEquation() + 4, out,
+                   [](double value) { return static_cast<Scalar>(value); });
+    extent = std::max(extent, std::abs(plane.getEquation()[3]));
+}
+
+template <typename Scalar>
+inline Scalar planeDistance(const Scalar plane[4], const Scalar p[3]) {
+    return plane[0] * p[0] + plane[1] * p[1] + plane[2] * p[2] + plane[3];
+}
+
+} // namespace
+
+template <typename Scalar>
+BasicCompiledBSPTree<Scalar>::BasicCompiledBSPTree(const BSPTree &tree) {
+    auto arrays = std::make_shared<Arrays>();
+    double extent = 0;
+    if (tree.getRoot() != nullptr) {
+        compileNode(tree.getRoot(), *arrays, extent);
+    }
+    // rounding to the scalar moves coordinates and offsets by a few units in the last place of the extent
+    tolerance = std::max(EPSILON, static_cast<Scalar>(8 * std::numeric_limits<Scalar>::epsilon() * extent));
+    nodes = arrays->nodes.data();
+    nodesCount = arrays->nodes.size();
+    polygons = arrays->polygons.data();
+    polygonsCount = arrays->polygons.size();
+    vertices = arrays->vertices.data();
+    verticesCount = arrays->vertices.size();
+    storage = std::move(arrays);
+}
+
+template <typename Scalar>
+uint32_t BasicCompiledBSPTree<Scalar>::compileNode(const BSPNode *node, Arrays &arrays, double &extent) {
+    auto &nodes = arrays.nodes;
+    auto &polygons = arrays.polygons;
+    auto &vertices = arrays.vertices;
+    auto index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    Node compiled{};
+    packPlane(node->getPartition(), compiled.plane, extent);
+    compiled.firstPolygon = static_cast<uint32_t>(polygons.size());
+    compiled.polygonCount = static_cast<uint32_t>(node->getPolygons().size());
+    for (const auto &polygon: node->getPolygons()) {
+        PolygonRecord record{};
+        packPlane(polygon.getPlane(), record.plane, extent);
+        record.firstVertex = static_cast<uint32_t>(vertices.size() / 3);
+        record.vertexCount = static_cast<uint32_t>(polygon.getVertices().size());
+        for (const auto &vertex: polygon.getVertices()) {
+            for (double coordinate: {vertex.getX().getValue(), vertex.getY().getValue(), vertex.getZ().getValue()}) {
+                vertices.push_back(static_cast<Scalar>(coordinate));
+                extent = std::max(extent, std::abs(coordinate));
+            }
+        }
+        polygons.push_back(record);
+    }
+    // depth-first: the front subtree is laid out right after its parent
+    compiled.front = node->getFront() != nullptr ? compileNode(node->getFront(), arrays, extent) : NONE;
+    compiled.back = node->getBack() != nullptr ? compileNode(node->getBack(), arrays, extent) : NONE;
+    nodes[index] = compiled;
+    return index;
+}
+
+template <typename Scalar>
+void BasicCompiledBSPTree<Scalar>::save(const std::string &path) const {
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.scalarSize = sizeof(Scalar);
+    header.nodeSize = sizeof(Node);
+    header.polygonSize = sizeof(PolygonRecord);
+    header.nodesOffset = alignSection(sizeof(FileHeader));
+    header.nodesCount = nodesCount;
+    header.polygonsOffset = alignSection(header.nodesOffset + nodesCount * sizeof(Node));
+    header.polygonsCount = polygonsCount;
+    header.verticesOffset = alignSection(header.polygonsOffset + polygonsCount * sizeof(PolygonRecord));
+    header.verticesCount = verticesCount;
+    header.fileSize = header.verticesOffset + verticesCount * sizeof(Scalar);
+    header.tolerance = tolerance;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Cannot create " + path);
+    }
+    auto writeSection = [&file](uint64_t offset, const void *data, size_t bytes) {
+        // zero padding up to the aligned offset
+        static const char padding[SECTION_ALIGNMENT] = {};
+        file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+        file.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+    };
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    writeSection(header.nodesOffset, nodes, nodesCount * sizeof(Node));
+    writeSection(header.polygonsOffset, polygons, polygonsCount * sizeof(PolygonRecord));
+    writeSection(header.verticesOffset, vertices, verticesCount * sizeof(Scalar));
+    if (!file.flush()) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+}
+
+template <typename Scalar>
+BasicCompiledBSPTree<Scalar> BasicCompiledBSPTree<Scalar>::load(const std::string &path) {
+    auto file = std::make_shared<MappedFile>(path);
+    if (file->getSize() < sizeof(FileHeader)) {
+        throw std::runtime_error(path + " is not a saved BSP tree");
+    }
+    FileHeader header{};
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error(path + " is not a saved BSP tree");
+    }
+    if (header.version != FORMAT_VERSION) {
+        throw std::runtime_error(path + " has an unsupported format version " + std::to_string(header.version));
+    }
+    if (header.byteOrder != BYTE_ORDER_MARK || header.scalarSize != sizeof(Scalar) ||
+        header.nodeSize != sizeof(Node) || header.polygonSize != sizeof(PolygonRecord)) {
+        throw std::runtime_error(path + " was saved with a different byte order or layout");
+    }
+    // every array must be aligned and inside the file
+    auto sectionFits = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % SECTION_ALIGNMENT == 0 && offset <= file->getSize() &&
+               count <= (file->getSize() - offset) / size;
+    };
+    if (header.fileSize != file->getSize() || !sectionFits(header.nodesOffset, header.nodesCount, sizeof(Node)) ||
+        !sectionFits(header.polygonsOffset, header.polygonsCount, sizeof(PolygonRecord)) ||
+        !sectionFits(header.verticesOffset, header.verticesCount, sizeof(Scalar))) {
+        throw std::runtime_error(path + " is truncated or corrupt");
+    }
+    // every index inside its array and children after their parent, so that queries stay in the
+    // file and every walk ends: one pass over the nodes and the polygons
+    const auto *nodes = reinterpret_cast<const Node *>(file->data() + header.nodesOffset);
+    const auto *polygons = reinterpret_cast<const PolygonRecord *>(file->data() + header.polygonsOffset);
+    auto childFits = [&header](uint64_t parent, uint32_t child) {
+        return child == NONE || (child > parent && child < header.nodesCount);
+    };
+    bool valid = header.nodesCount < NONE && header.polygonsCount < NONE && header.verticesCount % 3 == 0 &&
+                 header.verticesCount / 3 < NONE;
+    for (uint64_t i = 0; valid && i < header.nodesCount; ++i) {
+        const Node &node = nodes[i];
+        valid = childFits(i, node.front) && childFits(i, node.back) &&
+                uint64_t(node.firstPolygon) + node.polygonCount <= header.polygonsCount;
+    }
+    for (uint64_t i = 0; valid && i < header.polygonsCount; ++i) {
+        const PolygonRecord &polygon = polygons[i];
+        valid = uint64_t(polygon.firstVertex) + polygon.vertexCount <= header.verticesCount / 3;
+    }
+    if (!valid) {
+        throw std::runtime_error(path + " has indices out of range");
+    }
+
+    BasicCompiledBSPTree tree;
+    tree.tolerance = static_cast<Scalar>(header.tolerance);
+    tree.nodes = nodes;
+    tree.nodesCount = header.nodesCount;
+    tree.polygons = polygons;
+    tree.polygonsCount = header.polygonsCount;
+    tree.vertices = reinterpret_cast<const Scalar *>(file->data() + header.verticesOffset);
+    tree.verticesCount = header.verticesCount;
+    tree.storage = std::move(file);
+    return tree;
+}
+
+template <typename Scalar>
+Polygon BasicCompiledBSPTree<Scalar>::getPolygon(uint32_t index) const {
+    const auto &record = polygons[index];
+    std::vector<Point3D> points;
+    points.reserve(record.vertexCount);
+    for (uint32_t i = 0; i < record.vertexCount; ++i) {
+        const Scalar *v = &vertices[3 * (record.firstVertex + i)];
+        points.emplace_back(v[0], v[1], v[2]);
+    }
+    return Polygon(points);
+}
+
+template <typename Scalar>
+bool BasicCompiledBSPTree<Scalar>::polygonContains(const PolygonRecord &polygon, const Scalar p[3]) const {
+    // same test as Polygon::contains: on the plane and inside every edge
+    if (std::abs(planeDistance(polygon.plane, p)) >= tolerance) {
+        return false;
+    }
+    const Scalar *n = polygon.plane;
+    const Scalar *first = &vertices[3 * polygon.firstVertex];
+    for (uint32_t i = 0; i < polygon.vertexCount; ++i) {
+        const Scalar *a = first + 3 * i;
+        const Scalar *b = first + 3 * ((i + 1) % polygon.vertexCount);
+        Scalar edge[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        Scalar toPoint[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+        Scalar edgeMag = std::sqrt(edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]);
+        if (edgeMag < tolerance) {
+            continue;
+        }
+        Scalar cross[3] = {
+                edge[1] * toPoint[2] - edge[2] * toPoint[1],
+                edge[2] * toPoint[0] - edge[0] * toPoint[2],
+                edge[0] * toPoint[1] - edge[1] * toPoint[0]
+        };
+        if ((n[0] * cross[0] + n[1] * cross[1] + n[2] * cross[2]) / edgeMag < -tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Scalar>
+typename BasicCompiledBSPTree<Scalar>::Hit BasicCompiledBSPTree<Scalar>::detectCollision(const LineSegment &traceLine) const {
+    BSP_COUNT(queries, 1);
+    Hit hit;
+    if (nodesCount == 0) {
+        return hit;
+    }
+    auto p1 = traceLine.getP1();
+    auto p2 = traceLine.getP2();
+    const Scalar origin[3] = {static_cast<Scalar>(p1.getX().getValue()), static_cast<Scalar>(p1.getY().getValue()),
+                              static_cast<Scalar>(p1.getZ().getValue())};
+    const Scalar direction[3] = {static_cast<Scalar>(p2.getX().getValue()) - origin[0],
+                                 static_cast<Scalar>(p2.getY().getValue()) - origin[1],
+                                 static_cast<Scalar>(p2.getZ().getValue()) - origin[2]};
+
+    // Pending far sides. Before descending into one, the polygons of the node whose
+    // partition produced it are tested at the crossing point
+    struct Pending {
+        uint32_t node;
+        uint32_t crossedNode;
+        Scalar tMin, tMax;
+    };
+    std::vector<Pending> stack;
+    stack.push_back({0, NONE, 0, 1});
+
+    while (!stack.empty()) {
+        auto [index, crossedNode, tMin, tMax] = stack.back();
+        stack.pop_back();
+
+        if (crossedNode != NONE) {
+            const Node &crossed = nodes[crossedNode];
+            const Scalar point[3] = {origin[0] + direction[0] * tMin, origin[1] + direction[1] * tMin,
+                                     origin[2] + direction[2] * tMin};
+            for (uint32_t i = 0; i < crossed.polygonCount; ++i) {
+                BSP_COUNT(polygonTests, 1);
+                if (polygonContains(polygons[crossed.firstPolygon + i], point)) {
+                    Scalar length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] +
+                                              direction[2] * direction[2]);
+                    hit.polygon = crossed.firstPolygon + i;
+                    hit.distance = length * tMin;
+                    hit.point = Point3D(point[0], point[1], point[2]);
+                    return hit;
+                }
+            }
+        }
+
+        while (index != NONE) {
+            BSP_COUNT(nodesVisited, 1);
+            BSP_COUNT(planeTests, 1);
+            const Node &node = nodes[index];
+            Scalar originDist = planeDistance(node.plane, origin);
+            Scalar directionDist = node.plane[0] * direction[0] + node.plane[1] * direction[1] +
+                                   node.plane[2] * direction[2];
+            Scalar startDist = originDist + directionDist * tMin;
+            Scalar endDist = originDist + directionDist * tMax;
+            bool startInFront = startDist >= -tolerance;
+            bool endInFront = endDist >= -tolerance;
+            if (startInFront == endInFront) {
+                index = startInFront ? node.front : node.back;
+                continue;
+            }
+            // crossing: walk the near side now, the node and the far side later
+            Scalar ratio = std::min(std::max(startDist / (startDist - endDist), Scalar(0)), Scalar(1));
+            Scalar tSplit = tMin + (tMax - tMin) * ratio;
+            stack.push_back({startInFront ? node.back : node.front, index, tSplit, tMax});
+            index = startInFront ? node.front : node.back;
+            tMax = tSplit;
+        }
+    }
+    return hit;
+}
+
+template <typename Scalar>
+uint32_t BasicCompiledBSPTree<Scalar>::locatePoint(const Point3D &p) const {
+    if (nodesCount == 0) {
+        return NONE;
+    }
+    BSP_COUNT(queries, 1);
+    const Scalar point[3] = {static_cast<Scalar>(p.getX().getValue()), static_cast<Scalar>(p.getY().getValue()),
+                             static_cast<Scalar>(p.getZ().getValue())};
+    uint32_t index = 0;
+    while (true) {
+        BSP_COUNT(nodesVisited, 1);
+        BSP_COUNT(planeTests, 1);
+        const Node &node = nodes[index];
+        uint32_t next = planeDistance(node.plane, point) >= -tolerance ? node.front : node.back;
+        if (next == NONE) {
+            return index;
+        }
+        index = next;
+    }
+}
+
+template class BasicCompiledBSPTree<double>;
+template class BasicCompiledBSPTree<float>;
@@ -0,0 +1,143 @@
+#ifndef COMPILED_BSP_H
+#define COMPILED_BSP_H
+
+#include "DataType.h"
+#include "Point.h"
+#include "Line.h"
+#include "Plane.h"
+#include "BSPTree.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Immutable, flattened form of a built BSPTree for queries, in double (CompiledBSPTree) or single
+// precision (CompiledBSPTree32).
+// Nodes live in one array in depth-first order (the front child follows its parent), children are
+// 32-bit indices, planes are packed as (nx, ny, nz, d) with a unit normal, and the polygons of a
+// node are a range of polygon records whose vertices are ranges of one shared vertex buffer.
+//
+// The tree is built in double precision and only exported in the scalar of the compiled tree.
+// CompiledBSPTree32 is a memory footprint option only: its planes and vertices take half the
+// memory (and file size), but the queries walk one segment or point at a time in scalar code,
+// without the Classification kernels, so float32 brings no wider SIMD and no faster queries by
+// itself. Its coordinates are rounded by up to a relative 2^-24, so the plane and containment
+// tests of the queries use a tolerance that grows with the extent of the scene: getTolerance() =
+// max(EPSILON, 8 * epsilon of the scalar * largest coordinate or plane offset). Queries agree with
+// the double tree except for segments and points within the tolerance of a partition or of a
+// polygon edge.
+//
+// The three arrays only hold indices, so they can be written to a file as they are (save) and
+// mapped back read-only (load): queries then run on the mapped pages, without parsing or copying,
+// and processes mapping the same file share them. Copies of a tree share its arrays.
+//
+// File format (version 2), native byte order, every array aligned to 64 bytes from the start:
+//   FileHeader | Node[nodesCount] | PolygonRecord[polygonsCount] | Scalar[verticesCount]
+// A file can only be loaded with the scalar it was saved with
+template <typename ScalarType>
+class BasicCompiledBSPTree {
+public:
+    using Scalar = ScalarType;
+    static_assert(std::is_floating_point<Scalar>::value, "Scalar must be a floating-point type");
+
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+    static constexpr Scalar EPSILON = static_cast<Scalar>(1e-6);
+
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    struct Node {
+        Scalar plane[4];        // n·x + d is the signed distance to the partition
+        uint32_t front, back;   // child indices or NONE
+        uint32_t firstPolygon, polygonCount;
+    };
+
+    struct PolygonRecord {
+        Scalar plane[4];        // plane of the polygon itself, used by the containment test
+        uint32_t firstVertex, vertexCount;
+    };
+
+    // Result of a segment query
+    struct Hit {
+        uint32_t polygon = NONE;
+        Scalar distance = 0;
+        Point3D point;
+
+        explicit operator bool() const { return polygon != NONE; }
+    };
+
+    // First bytes of a saved tree. Offsets are from the start of the file
+    struct FileHeader {
+        char magic[8];              // "BSPTREE" and a zero
+        uint32_t version;           // FORMAT_VERSION
+        uint32_t byteOrder;         // 0x01020304 as written by the saving machine
+        uint32_t scalarSize;        // sizeof(Scalar)
+        uint32_t nodeSize, polygonSize, reserved;
+        uint64_t nodesOffset, nodesCount;
+        uint64_t polygonsOffset, polygonsCount;
+        uint64_t verticesOffset, verticesCount;     // in scalars, 3 per vertex
+        uint64_t fileSize;
+        double tolerance;           // of the plane and containment tests, see getTolerance
+    };
+
+    static_assert(std::is_trivially_copyable<Node>::value && std::is_trivially_copyable<PolygonRecord>::value &&
+                  std::is_trivially_copyable<FileHeader>::value, "saved structures must be plain bytes");
+
+private:
+    // Owner of the arrays: vectors for a compiled tree, a read-only mapping for a loaded one
+    std::shared_ptr<const void> storage;
+    const Node *nodes = nullptr;
+    size_t nodesCount = 0;
+    const PolygonRecord *polygons = nullptr;
+    size_t polygonsCount = 0;
+    const Scalar *vertices = nullptr;   // x, y, z per vertex
+    size_t verticesCount = 0;           // in scalars
+    Scalar tolerance = EPSILON;
+
+    struct Arrays;
+    static uint32_t compileNode(const BSPNode *node, Arrays &arrays, double &extent);
+    bool polygonContains(const PolygonRecord &polygon, const Scalar p[3]) const;
+
+public:
+    BasicCompiledBSPTree() = default;
+    explicit BasicCompiledBSPTree(const BSPTree &tree);
+
+    // Write the tree to 'path' in the format above. Throws std::runtime_error on failure
+    void save(const std::string &path) const;
+
+    // Map a file written by save, read-only. The header, the array bounds and every index of the
+    // nodes and polygons are checked, in one pass over them; the coordinates are trusted. Throws
+    // std::runtime_error when the file cannot be used
+    static BasicCompiledBSPTree load(const std::string &path);
+
+    // Getters
+    size_t getNodesCount() const { return nodesCount; }
+    size_t getPolygonsCount() const { return polygonsCount; }
+    size_t getVerticesCount() const { return verticesCount / 3; }
+    Scalar getTolerance() const { return tolerance; }
+    size_t memoryBytes() const {
+        return nodesCount * sizeof(Node) + polygonsCount * sizeof(PolygonRecord) + verticesCount * sizeof(Scalar);
+    }
+    const Node &getNode(uint32_t index) const { return nodes[index]; }
+    const PolygonRecord &getPolygonRecord(uint32_t index) const { return polygons[index]; }
+    Polygon getPolygon(uint32_t index) const;    // Rebuild a polygon from the vertex buffer
+
+    // Check if the tree is empty
+    bool isEmpty() const { return nodesCount == 0; }
+
+    // Detect collision with a line (first polygon hit along the segment)
+    Hit detectCollision(const LineSegment &traceLine) const;
+
+    // Index of the last node on the path of the point, i.e. the cell of the tree containing it
+    uint32_t locatePoint(const Point3D &p) const;
+};
+
+using CompiledBSPTree = BasicCompiledBSPTree<double>;
+// Half the memory of CompiledBSPTree, but not faster: there are no float query kernels
+using CompiledBSPTree32 = BasicCompiledBSPTree<float>;
+
+// Defined in CompiledBSPTree.cpp for these two scalars only
+extern template class BasicCompiledBSPTree<double>;
+extern template class BasicCompiledBSPTree<float>;
+
+#endif // COMPILED_BSP_H
@@ -0,0 +1,356 @@
+#include "ConcurrentBSPTree.h"
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Compact once the versions reach this many arenas, even if the copies are few
+constexpr size_t MAX_STORAGE = 64;
+
+} // namespace
+
+// Snapshot
+
+ConcurrentBSPTree::Snapshot::Snapshot(const ConcurrentBSPTree &tree) : tree(&tree) {
+    version = tree.acquire(slot);
+}
+
+ConcurrentBSPTree::Snapshot::Snapshot(Snapshot &&other) noexcept
+        : tree(other.tree), slot(other.slot), version(other.version) {
+    other.tree = nullptr;
+    other.slot = nullptr;
+    other.version = nullptr;
+}
+
+ConcurrentBSPTree::Snapshot &ConcurrentBSPTree::Snapshot::operator=(Snapshot &&other) noexcept {
+    if (this != &other) {
+        release();
+        std::swap(tree, other.tree);
+        std::swap(slot, other.slot);
+        std::swap(version, other.version);
+    }
+    return *this;
+}
+
+void ConcurrentBSPTree::Snapshot::release() {
+    if (slot != nullptr) {
+        slot->epoch.store(IDLE);
+    }
+    tree = nullptr;
+    slot = nullptr;
+    version = nullptr;
+}
+
+Collision ConcurrentBSPTree::Snapshot::detectCollision(const LineSegment &traceLine) const {
+    return getRoot() != nullptr ? getRoot()->detectCollision(traceLine) : Collision();
+}
+
+void ConcurrentBSPTree::Snapshot::detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const {
+    if (getRoot() != nullptr) {
+        getRoot()->detectCollisions(traceLines, count, hits);
+    } else {
+        std::fill_n(hits, count, Collision());
+    }
+}
+
+std::vector<Collision> ConcurrentBSPTree::Snapshot::detectCollisions(const std::vector<LineSegment> &traceLines) const {
+    std::vector<Collision> hits(traceLines.size());
+    detectCollisions(traceLines.data(), traceLines.size(), hits.data());
+    return hits;
+}
+
+std::vector<const Polygon *> ConcurrentBSPTree::Snapshot::queryVolume(const std::vector<Plane> &planes) const {
+    if (planes.size() > 64) {
+        throw std::runtime_error("queryVolume supports at most 64 planes");
+    }
+    std::vector<const Polygon *> result;
+    if (getRoot() != nullptr) {
+        getRoot()->queryVolume(planes.data(), planes.size(), result);
+    }
+    return result;
+}
+
+// Readers
+
+const ConcurrentBSPTree::Version *ConcurrentBSPTree::acquire(ReaderSlot *&slot) const {
+    // The epoch is announced before the version is loaded: an editor that finds the slot idle or
+    // newer than a retired version has published its replacement before, so it is not the one
+    // loaded. Threads start at different slots to keep clear of each other
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (;;) {
+        for (size_t i = 0; i < READER_SLOTS; ++i) {
+            ReaderSlot &candidate = readers[(start + i) % READER_SLOTS];
+            uint64_t idle = IDLE;
+            if (candidate.epoch.load(std::memory_order_relaxed) == IDLE &&
+                candidate.epoch.compare_exchange_strong(idle, globalEpoch.load())) {
+                slot = &candidate;
+                return current.load();
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+// Versions
+
+ConcurrentBSPTree::ConcurrentBSPTree() : current(new Version), globalEpoch(0), nextId(0), copiedNodes(0) {
+    for (auto &reader: readers) {
+        reader.epoch.store(IDLE);
+    }
+}
+
+ConcurrentBSPTree::~ConcurrentBSPTree() {
+    for (const auto &entry: retired) {
+        delete entry.version;
+    }
+    delete current.load();
+}
+
+uint64_t ConcurrentBSPTree::getVersion() const {
+    return snapshot().getVersion();
+}
+
+void ConcurrentBSPTree::publish(Version *version) {
+    const Version *old = current.exchange(version);
+    retired.push_back({old, globalEpoch.fetch_add(1) + 1});
+    reclaimRetired();
+}
+
+void ConcurrentBSPTree::publish(const BSPNode *root, Edit &edit) {
+    auto *version = new Version;
+    const Version *old = current.load();
+    version->number = old->number + 1;
+    version->root = root;
+    if (root != nullptr) {
+        version->storage = old->storage;
+        if (!edit.created.empty()) {
+            version->storage.push_back(edit.arena);
+        }
+        copiedNodes += edit.created.size();
+        // the copies outgrew the tree: copy it once more, alone, so the older arenas can go
+        if (copiedNodes > root->getNodesCount() || version->storage.size() > MAX_STORAGE) {
+            auto arena = std::make_shared<Arena>();
+            version->root = copySubtree(root, arena->getResource());
+            version->storage = {arena};
+            copiedNodes = 0;
+        }
+    } else {
+        copiedNodes = 0;
+    }
+    publish(version);
+}
+
+void ConcurrentBSPTree::reclaimRetired() {
+    uint64_t oldest = IDLE;
+    for (const auto &reader: readers) {
+        oldest = std::min(oldest, reader.epoch.load());
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(), [oldest](const Retired &entry) {
+        if (entry.epoch > oldest) {
+            return false;
+        }
+        delete entry.version;
+        return true;
+    }), retired.end());
+}
+
+size_t ConcurrentBSPTree::reclaim() {
+    std::lock_guard<std::mutex> lock(editMutex);
+    reclaimRetired();
+    return retired.size();
+}
+
+// Edits
+
+BSPNode *ConcurrentBSPTree::Edit::writable(const BSPNode *node) {
+    if (created.count(node) > 0) {
+        return const_cast<BSPNode *>(node);
+    }
+    auto *copy = Arena::create<BSPNode>(arena->getResource(), node->getPartition(), arena->getResource());
+    copy->polygons.assign(node->polygons.begin(), node->polygons.end());
+    copy->front = node->front;
+    copy->back = node->back;
+    copy->setOwnSplitFragments(node->getOwnSplitFragments());
+    created.insert(copy);
+    return copy;
+}
+
+BSPNode *ConcurrentBSPTree::Edit::leaf(const Polygon &polygon) {
+    auto *node = Arena::create<BSPNode>(arena->getResource(), polygon.getPlane(), arena->getResource());
+    node->polygons.push_back(polygon);
+    node->updateSummary();
+    created.insert(node);
+    return node;
+}
+
+void ConcurrentBSPTree::Edit::finish(BSPNode *node) const {
+    for (BSPNode *child: {node->front, node->back}) {
+        if (child != nullptr && created.count(child) > 0) {
+            child->setParent(node);
+        }
+    }
+    node->updateSummary();
+}
+
+BSPNode *ConcurrentBSPTree::insertPolygon(const BSPNode *node, const Polygon &polygon, Edit &edit) {
+    if (node == nullptr) {
+        return edit.leaf(polygon);
+    }
+    // same walk as BSPNode::insert, on copies of the nodes it passes through
+    BSPNode *copy = edit.writable(node);
+    switch (polygon.relationWithPlane(copy->partition)) {
+        case COINCIDENT:
+            copy->polygons.push_back(polygon);
+            break;
+        case IN_FRONT:
+            copy->front = insertPolygon(copy->front, polygon, edit);
+            break;
+        case BEHIND:
+            copy->back = insertPolygon(copy->back, polygon, edit);
+            break;
+        case SPLIT: {
+            SplitBuffer parts;
+            parts.split(polygon, copy->partition);
+            if (!parts.front.isDegenerate()) {
+                copy->front = insertPolygon(copy->front, parts.front, edit);
+            }
+            if (!parts.back.isDegenerate()) {
+                copy->back = insertPolygon(copy->back, parts.back, edit);
+            }
+            break;
+        }
+    }
+    edit.finish(copy);
+    return copy;
+}
+
+BSPNode *ConcurrentBSPTree::removePolygon(const BSPNode *node, const Polygon &polygon, PolygonId id, Edit &edit) {
+    if (node == nullptr) {
+        return nullptr;
+    }
+    // the partitions never change, so the polygon takes the paths (and splits) it took on insert
+    BSPNode *copy = edit.writable(node);
+    switch (polygon.relationWithPlane(copy->partition)) {
+        case COINCIDENT:
+            copy->removePolygons(id);
+            break;
+        case IN_FRONT:
+            copy->front = removePolygon(copy->front, polygon, id, edit);
+            break;
+        case BEHIND:
+            copy->back = removePolygon(copy->back, polygon, id, edit);
+            break;
+        case SPLIT: {
+            SplitBuffer parts;
+            parts.split(polygon, copy->partition);
+            if (!parts.front.isDegenerate()) {
+                copy->front = removePolygon(copy->front, parts.front, id, edit);
+            }
+            if (!parts.back.isDegenerate()) {
+                copy->back = removePolygon(copy->back, parts.back, id, edit);
+            }
+            break;
+        }
+    }
+    // an empty node with one child only splits off empty space
+    if (copy->polygons.empty() && (copy->front == nullptr || copy->back == nullptr)) {
+        return copy->front != nullptr ? copy->front : copy->back;
+    }
+    edit.finish(copy);
+    return copy;
+}
+
+BSPNode *ConcurrentBSPTree::copySubtree(const BSPNode *node, std::pmr::memory_resource *resource) {
+    if (node == nullptr) {
+        return nullptr;
+    }
+    auto *copy = Arena::create<BSPNode>(resource, node->getPartition(), resource);
+    copy->polygons.assign(node->polygons.begin(), node->polygons.end());
+    copy->setOwnSplitFragments(node->getOwnSplitFragments());
+    copy->front = copySubtree(node->front, resource);
+    copy->back = copySubtree(node->back, resource);
+    for (BSPNode *child: {copy->front, copy->back}) {
+        if (child != nullptr) {
+            child->setParent(copy);
+        }
+    }
+    copy->updateSummary();
+    return copy;
+}
+
+BuildStats ConcurrentBSPTree::build(std::vector<Polygon> polygons, const SplitterSelector &selector) {
+    // built aside, readers keep the current version meanwhile
+    auto tree = std::make_shared<BSPTree>();
+    BuildStats stats = tree->build(polygons, selector);
+
+    std::lock_guard<std::mutex> lock(editMutex);
+    sources.clear();
+    for (size_t i = 0; i < polygons.size(); ++i) {
+        if (!polygons[i].isDegenerate()) {
+            polygons[i].setId(static_cast<PolygonId>(i));
+            sources.emplace(static_cast<PolygonId>(i), std::move(polygons[i]));
+        }
+    }
+    nextId = static_cast<PolygonId>(polygons.size());
+    copiedNodes = 0;
+
+    auto *version = new Version;
+    version->number = current.load()->number + 1;
+    version->root = tree->getRoot();
+    if (version->root != nullptr) {
+        version->storage = {tree};
+    }
+    publish(version);
+    return stats;
+}
+
+PolygonId ConcurrentBSPTree::insert(const Polygon &polygon) {
+    return insert(std::vector<Polygon>{polygon}).front();
+}
+
+std::vector<PolygonId> ConcurrentBSPTree::insert(const std::vector<Polygon> &polygons) {
+    std::vector<PolygonId> ids;
+    ids.reserve(polygons.size());
+    std::lock_guard<std::mutex> lock(editMutex);
+    Edit edit{std::make_shared<Arena>(), {}};
+    const BSPNode *root = current.load()->root;
+    for (const auto &polygon: polygons) {
+        if (polygon.isDegenerate()) {
+            ids.push_back(NO_POLYGON_ID);
+            continue;
+        }
+        PolygonId id = nextId++;
+        Polygon &source = sources.emplace(id, polygon).first->second;
+        source.setId(id);
+        root = insertPolygon(root, source, edit);
+        ids.push_back(id);
+    }
+    publish(root, edit);
+    return ids;
+}
+
+bool ConcurrentBSPTree::remove(PolygonId id) {
+    return remove(std::vector<PolygonId>{id}) == 1;
+}
+
+size_t ConcurrentBSPTree::remove(const std::vector<PolygonId> &ids) {
+    std::lock_guard<std::mutex> lock(editMutex);
+    Edit edit{std::make_shared<Arena>(), {}};
+    const BSPNode *root = current.load()->root;
+    size_t removed = 0;
+    for (PolygonId id: ids) {
+        auto source = sources.find(id);
+        if (source == sources.end()) {
+            continue;
+        }
+        root = removePolygon(root, source->second, id, edit);
+        sources.erase(source);
+        removed++;
+    }
+    if (removed > 0) {
+        publish(root, edit);
+    }
+    return removed;
+}
@@ -0,0 +1,159 @@
+#ifndef CONCURRENT_BSP_H
+#define CONCURRENT_BSP_H
+
+#include "DataType.h"
+#include "Point.h"
+#include "Line.h"
+#include "Plane.h"
+#include "Arena.h"
+#include "BSPTree.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// BSP-tree that many threads query while edits are applied, without locks on the query side.
+//
+// Every edit publishes a new immutable version of the tree: the nodes on the paths it changes are
+// copied (path copying) and the new root is swapped in atomically, the rest of the nodes is shared
+// with the previous version. Readers take a Snapshot, which pins the version current at that time:
+// queries on it never see a half applied edit and never wait for the editor.
+//
+// Reclamation is epoch based. A snapshot announces the epoch it started in, in one of a fixed set of
+// reader slots. Each replaced version is retired with the epoch of its replacement and deleted once
+// no slot holds an older epoch. The nodes of a version live in the arena of the edit that created
+// them (or the build), kept alive by every version that still reaches them; once the copies made
+// by the edits outgrow the tree, the next edit compacts the tree into a fresh arena so that the
+// old ones can go.
+//
+// Edits are serialized with a mutex. Parent links are not maintained in the versions (shared nodes
+// have a parent in each of them), queries that walk down from the root are the supported ones.
+class ConcurrentBSPTree {
+private:
+    struct Version {
+        const BSPNode *root = nullptr;
+        uint64_t number = 0;
+        // memory of the nodes reachable from root: the build tree and the arenas of the edits
+        std::vector<std::shared_ptr<const void>> storage;
+    };
+
+    struct Retired {
+        const Version *version;
+        uint64_t epoch;     // readers from this epoch on do not see it
+    };
+
+    // One per cache line, readers of different slots do not share lines
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch;
+    };
+
+    static constexpr uint64_t IDLE = UINT64_MAX;
+    static constexpr size_t READER_SLOTS = 128;
+
+    std::atomic<const Version *> current;
+    std::atomic<uint64_t> globalEpoch;
+    mutable std::array<ReaderSlot, READER_SLOTS> readers;
+
+    // Editor side, under editMutex
+    std::mutex editMutex;
+    std::unordered_map<PolygonId, Polygon> sources;     // to walk the paths of a polygon again on remove
+    PolygonId nextId;
+    std::vector<Retired> retired;
+    size_t copiedNodes;     // nodes created by edits since the last compaction
+
+    // Nodes of the version being edited: the ones created by this edit may be changed in place
+    struct Edit {
+        std::shared_ptr<Arena> arena;
+        std::unordered_set<const BSPNode *> created;
+
+        BSPNode *writable(const BSPNode *node);
+        BSPNode *leaf(const Polygon &polygon);
+        // Parent links of the new children and summary, once the children of the node are final
+        void finish(BSPNode *node) const;
+    };
+
+    BSPNode *insertPolygon(const BSPNode *node, const Polygon &polygon, Edit &edit);
+    BSPNode *removePolygon(const BSPNode *node, const Polygon &polygon, PolygonId id, Edit &edit);
+    static BSPNode *copySubtree(const BSPNode *node, std::pmr::memory_resource *resource);
+
+    void publish(const BSPNode *root, Edit &edit);
+    void publish(Version *version);
+    void reclaimRetired();
+
+    const Version *acquire(ReaderSlot *&slot) const;
+
+public:
+    // Read-only view of the version current when it was taken. Taking one is wait free except
+    // when more than READER_SLOTS snapshots are alive at once, then it waits for a free slot.
+    // Release it (destroy it) before the tree
+    class Snapshot {
+    private:
+        const ConcurrentBSPTree *tree = nullptr;
+        ReaderSlot *slot = nullptr;
+        const Version *version = nullptr;
+
+        friend class ConcurrentBSPTree;
+        explicit Snapshot(const ConcurrentBSPTree &tree);
+
+    public:
+        Snapshot() = default;
+        Snapshot(Snapshot &&other) noexcept;
+        Snapshot &operator=(Snapshot &&other) noexcept;
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+        ~Snapshot() { release(); }
+
+        // Unpin the version, the snapshot is empty afterwards
+        void release();
+
+        // Getters
+        const BSPNode *getRoot() const { return version != nullptr ? version->root : nullptr; }
+        uint64_t getVersion() const { return version != nullptr ? version->number : 0; }
+        size_t getPolygonsCount() const { return getRoot() != nullptr ? getRoot()->getPolygonsCount() : 0; }
+
+        // Queries, as in BSPTree
+        Collision detectCollision(const LineSegment &traceLine) const;
+        void detectCollisions(const LineSegment *traceLines, size_t count, Collision *hits) const;
+        std::vector<Collision> detectCollisions(const std::vector<LineSegment> &traceLines) const;
+        std::vector<const Polygon *> queryVolume(const std::vector<Plane> &planes) const;
+
+        template <typename Visitor>
+        bool traverse(const Point3D &eye, TraversalOrder order, Visitor &&visitor) const {
+            return getRoot() == nullptr || getRoot()->traverse(eye, order, std::forward<Visitor>(visitor));
+        }
+    };
+
+    ConcurrentBSPTree();
+    ~ConcurrentBSPTree();
+
+    ConcurrentBSPTree(const ConcurrentBSPTree &) = delete;
+    ConcurrentBSPTree &operator=(const ConcurrentBSPTree &) = delete;
+
+    // Pin the current version for queries
+    Snapshot snapshot() const { return Snapshot(*this); }
+
+    // Number of the current version, increased by every edit
+    uint64_t getVersion() const;
+
+    // Replace the contents with a tree built from all the polygons at once (see BSPTree::build),
+    // polygon i of the input gets the id i
+    BuildStats build(std::vector<Polygon> polygons, const SplitterSelector &selector = balancedSplitter());
+
+    // Edits, each call publishes one new version. Ids work as in BSPTree: insert returns
+    // NO_POLYGON_ID for a degenerate polygon, remove returns false for an unknown id. The batch
+    // versions apply all their polygons in one version
+    PolygonId insert(const Polygon &polygon);
+    std::vector<PolygonId> insert(const std::vector<Polygon> &polygons);
+    bool remove(PolygonId id);
+    size_t remove(const std::vector<PolygonId> &ids);
+
+    // Delete the retired versions no snapshot uses any more, edits do it as well. Returns how
+    // many are still waiting for their readers
+    size_t reclaim();
+};
+
+#endif // CONCURRENT_BSP_H
@@ -292,8 +292,164 @@ Safe<T> pow(const Safe<T>& base, const T& exponent) {
     return Safe<T>::pow(base, exponent);
 }
 
+// Same interface as Safe<T>, but plain floating point arithmetic: no checks, no throws.
+// Comparisons keep the epsilon tolerance (the geometry relies on it to detect coincidence),
+// which is a subtraction and a compare, so everything inlines down to raw T operations.
+template <typename T>
+class Fast {
+    // Only allows 'float', 'double', or 'long double'
+    static_assert(std::is_floating_point<T>::value, "Template type must be a floating-point type");
+
+private:
+    T value;
+    static constexpr T EPSILON = static_cast<T>(1e-6);
+
+public:
+    // Constructors
+    constexpr Fast() noexcept : value(static_cast<T>(0)) {}
+    constexpr Fast(T val) noexcept : value(val) {}
+
+    // Accessors
+    constexpr T getValue() const noexcept { return value; }
+    constexpr void setValue(T val) noexcept { value = val; }
+
+    // Unary operators
+    constexpr Fast operator-() const noexcept { return Fast(-value); }
+
+    // Arithmetic operators with Fast<T>
+    constexpr Fast& operator+=(const Fast& other) noexcept {
+        value += other.value;
+        return *this;
+    }
+    constexpr Fast& operator-=(const Fast& other) noexcept {
+        value -= other.value;
+        return *this;
+    }
+    constexpr Fast& operator*=(const Fast& other) noexcept {
+        value *= other.value;
+        return *this;
+    }
+    constexpr Fast& operator/=(const Fast& other) noexcept {
+        value /= other.value;
+        return *this;
+    }
+
+    // Arithmetic operators with built-in types
+    template <typename U>
+    constexpr Fast& operator+=(const U& other) noexcept {
+        static_assert(std::is_arithmetic<U>::value, "Operation only valid with numeric types");
+        value += static_cast<T>(other);
+        return *this;
+    }
+    template <typename U>
+    constexpr Fast& operator-=(const U& other) noexcept {
+        static_assert(std::is_arithmetic<U>::value, "Operation only valid with numeric types");
+        value -= static_cast<T>(other);
+        return *this;
+    }
+    template <typename U>
+    constexpr Fast& operator*=(const U& other) noexcept {
+        static_assert(std::is_arithmetic<U>::value, "Operation only valid with numeric types");
+        value *= static_cast<T>(other);
+        return *this;
+    }
+    template <typename U>
+    constexpr Fast& operator/=(const U& other) noexcept {
+        static_assert(std::is_arithmetic<U>::value, "Operation only valid with numeric types");
+        value /= static_cast<T>(other);
+        return *this;
+    }
+
+    // Arithmetic operators
+    friend constexpr Fast operator+(Fast lhs, const Fast& rhs) noexcept { return Fast(lhs.value + rhs.value); }
+    friend constexpr Fast operator-(Fast lhs, const Fast& rhs) noexcept { return Fast(lhs.value - rhs.value); }
+    friend constexpr Fast operator*(Fast lhs, const Fast& rhs) noexcept { return Fast(lhs.value * rhs.value); }
+    friend constexpr Fast operator/(Fast lhs, const Fast& rhs) noexcept { return Fast(lhs.value / rhs.value); }
+
+    // Arithmetic operators with built-in types
+    template <typename U>
+    friend constexpr Fast operator+(Fast lhs, const U& rhs) noexcept { return lhs += rhs; }
+    template <typename U>
+    friend constexpr Fast operator-(Fast lhs, const U& rhs) noexcept { return lhs -= rhs; }
+    template <typename U>
+    friend constexpr Fast operator*(Fast lhs, const U& rhs) noexcept { return lhs *= rhs; }
+    template <typename U>
+    friend constexpr Fast operator/(Fast lhs, const U& rhs) noexcept { return lhs /= rhs; }
+
+    // Comparison operators with Fast<T>
+    constexpr bool operator==(const Fast& other) const noexcept {
+        return value - other.value < EPSILON && other.value - value < EPSILON;
+    }
+    constexpr bool operator!=(const Fast& other) const noexcept { return !(*this == other); }
+    constexpr bool operator<(const Fast& other) const noexcept { return value < other.value - EPSILON; }
+    constexpr bool operator<=(const Fast& other) const noexcept { return value <= other.value + EPSILON; }
+    constexpr bool operator>(const Fast& other) const noexcept { return value > other.value + EPSILON; }
+    constexpr bool operator>=(const Fast& other) const noexcept { return value >= other.value - EPSILON; }
+
+    // Comparison operators with built-in types
+    template <typename U>
+    constexpr bool operator==(const U& other) const noexcept {
+        static_assert(std::is_arithmetic<U>::value, "Comparison only valid with numeric types");
+        return *this == Fast(static_cast<T>(other));
+    }
+    template <typename U>
+    constexpr bool operator!=(const U& other) const noexcept { return !(*this == other); }
+    template <typename U>
+    constexpr bool operator<(const U& other) const noexcept { return value < static_cast<T>(other) - EPSILON; }
+    template <typename U>
+    constexpr bool operator<=(const U& other) const noexcept { return value <= static_cast<T>(other) + EPSILON; }
+    template <typename U>
+    constexpr bool operator>(const U& other) const noexcept { return value > static_cast<T>(other) + EPSILON; }
+    template <typename U>
+    constexpr bool operator>=(const U& other) const noexcept { return value >= static_cast<T>(other) - EPSILON; }
+
+    // Friend functions for symmetric comparison with built-in types
+    template <typename U>
+    friend constexpr bool operator==(const U& lhs, const Fast& rhs) noexcept { return rhs == lhs; }
+    template <typename U>
+    friend constexpr bool operator!=(const U& lhs, const Fast& rhs) noexcept { return rhs != lhs; }
+    template <typename U>
+    friend constexpr bool operator<(const U& lhs, const Fast& rhs) noexcept { return lhs < rhs.value - EPSILON; }
+    template <typename U>
+    friend constexpr bool operator<=(const U& lhs, const Fast& rhs) noexcept { return lhs <= rhs.value + EPSILON; }
+    template <typename U>
+    friend constexpr bool operator>(const U& lhs, const Fast& rhs) noexcept { return lhs > rhs.value + EPSILON; }
+    template <typename U>
+    friend constexpr bool operator>=(const U& lhs, const Fast& rhs) noexcept { return lhs >= rhs.value - EPSILON; }
+
+    // Stream output
+    friend std::ostream& operator<<(std::ostream& os, const Fast& obj) {
+        os << obj.value;
+        return os;
+    }
+
+    // Mathematical functions
+    friend Fast abs(const Fast& x) noexcept { return Fast(std::abs(x.value)); }
+    friend Fast sqrt(const Fast& x) noexcept { return Fast(std::sqrt(x.value)); }
+    friend Fast pow(const Fast& base, const T& exponent) noexcept { return Fast(std::pow(base.value, exponent)); }
+    friend Fast min(const Fast& a, const Fast& b) noexcept { return a < b ? a : b; }
+    friend Fast max(const Fast& a, const Fast& b) noexcept { return a > b ? a : b; }
+
+    // Trigonometric functions
+    friend Fast sin(const Fast& x) noexcept { return Fast(std::sin(x.value)); }
+    friend Fast cos(const Fast& x) noexcept { return Fast(std::cos(x.value)); }
+    friend Fast tan(const Fast& x) noexcept { return Fast(std::tan(x.value)); }
+    friend Fast asin(const Fast& x) noexcept { return Fast(std::asin(x.value)); }
+    friend Fast acos(const Fast& x) noexcept { return Fast(std::acos(x.value)); }
+    friend Fast atan(const Fast& x) noexcept { return Fast(std::atan(x.value)); }
+
+    // Additional mathematical functions
+    friend Fast exp(const Fast& x) noexcept { return Fast(std::exp(x.value)); }
+    friend Fast log(const Fast& x) noexcept { return Fast(std::log(x.value)); }
+};
+
 // Typedefs
+// BSP_FAST_NUMERICS swaps the checked Safe<double> for the unchecked Fast<double> (same interface)
+#ifdef BSP_FAST_NUMERICS
+using NType = Fast<double>;
+#else
 using NType = Safe<double>;
+#endif
 
 // Relation type
 enum RelationType {
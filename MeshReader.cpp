@@ -0,0 +1,544 @@
+#include "MeshReader.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+constexpr size_t CHUNK_SIZE = 1 << 20;
+
+// Lines of a text stream, read in big chunks. A line stays valid until the next call
+class LineReader {
+private:
+    std::istream &in;
+    std::vector<char> buffer;
+    size_t begin = 0, end = 0;
+    bool finished = false;
+
+public:
+    explicit LineReader(std::istream &in) : in(in), buffer(CHUNK_SIZE) {}
+
+    // Next line, without the line terminator. False at the end of the stream
+    bool next(std::string_view &line) {
+        while (true) {
+            auto newline = std::find(buffer.begin() + begin, buffer.begin() + end, '\n');
+            if (newline != buffer.begin() + end || (finished && begin < end)) {
+                size_t lineEnd = newline - buffer.begin();
+                line = std::string_view(buffer.data() + begin, lineEnd - begin);
+                if (!line.empty() && line.back() == '\r') {
+                    line.remove_suffix(1);
+                }
+                begin = std::min(lineEnd + 1, end);
+                return true;
+            }
+            if (finished) {
+                return false;
+            }
+            // keep the partial line at the front, grow for lines longer than the buffer
+            std::copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+            end -= begin;
+            begin = 0;
+            if (end == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+            in.read(buffer.data() + end, static_cast<std::streamsize>(buffer.size() - end));
+            end += static_cast<size_t>(in.gcount());
+            finished = in.gcount() == 0;
+        }
+    }
+};
+
+// Whitespace separated tokens of a line, empty at the end
+class Tokenizer {
+private:
+    std::string_view text;
+
+public:
+    explicit Tokenizer(std::string_view text) : text(text) {}
+
+    std::string_view next() {
+        size_t first = 0;
+        while (first < text.size() && std::isspace(static_cast<unsigned char>(text[first]))) {
+            first++;
+        }
+        size_t last = first;
+        while (last < text.size() && !std::isspace(static_cast<unsigned char>(text[last]))) {
+            last++;
+        }
+        auto token = text.substr(first, last - first);
+        text.remove_prefix(last);
+        return token;
+    }
+};
+
+template <typename T>
+bool parseNumber(std::string_view token, T &value) {
+    auto result = std::from_chars(token.data(), token.data() + token.size(), value);
+    return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+// Bytes of a binary stream, read in big chunks
+class ByteReader {
+private:
+    std::istream &in;
+    std::vector<char> buffer;
+    size_t begin = 0, end = 0;
+
+public:
+    explicit ByteReader(std::istream &in) : in(in), buffer(CHUNK_SIZE) {}
+
+    // False if the stream ended first
+    bool read(void *out, size_t bytes) {
+        auto *destination = static_cast<char *>(out);
+        while (bytes > 0) {
+            if (begin == end) {
+                in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                begin = 0;
+                end = static_cast<size_t>(in.gcount());
+                if (end == 0) {
+                    return false;
+                }
+            }
+            size_t copied = std::min(bytes, end - begin);
+            std::memcpy(destination, buffer.data() + begin, copied);
+            destination += copied;
+            begin += copied;
+            bytes -= copied;
+        }
+        return true;
+    }
+};
+
+// Little endian values, whatever the byte order of the machine
+uint32_t littleEndian32(const unsigned char *bytes) {
+    return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+float littleEndianFloat(const unsigned char *bytes) {
+    uint32_t bits = littleEndian32(bytes);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Hands the batch to the consumer once it is full (or at the end, when 'flush')
+void deliver(PolygonBatch &batch, size_t batchPolygons, const BatchConsumer &consumer, bool flush) {
+    if (batch.size() >= batchPolygons || (flush && !batch.empty())) {
+        consumer(batch);
+        batch.clear();
+    }
+}
+
+std::runtime_error parseError(const char *format, size_t line, const std::string &message) {
+    return std::runtime_error(std::string(format) + " line " + std::to_string(line) + ": " + message);
+}
+
+// PLY header
+enum PLYType { INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    bool isList = false;
+    PLYType countType = UINT8;
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PLYProperty> properties;
+};
+
+PLYType plyType(const std::string &name) {
+    static const std::pair<const char *, PLYType> names[] = {
+            {"char", INT8}, {"int8", INT8}, {"uchar", UINT8}, {"uint8", UINT8},
+            {"short", INT16}, {"int16", INT16}, {"ushort", UINT16}, {"uint16", UINT16},
+            {"int", INT32}, {"int32", INT32}, {"uint", UINT32}, {"uint32", UINT32},
+            {"float", FLOAT32}, {"float32", FLOAT32}, {"double", FLOAT64}, {"float64", FLOAT64}
+    };
+    for (const auto &[typeName, type]: names) {
+        if (name == typeName) {
+            return type;
+        }
+    }
+    throw std::runtime_error("PLY: unknown property type " + name);
+}
+
+size_t plyTypeSize(PLYType type) {
+    switch (type) {
+        case INT8:
+        case UINT8:
+            return 1;
+        case INT16:
+        case UINT16:
+            return 2;
+        case INT32:
+        case UINT32:
+        case FLOAT32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+// Values of the ascii body, one token after the other
+class PLYAsciiSource {
+private:
+    LineReader lines;
+    Tokenizer tokens{std::string_view()};
+
+public:
+    explicit PLYAsciiSource(std::istream &in) : lines(in) {}
+
+    double next(PLYType) {
+        auto token = tokens.next();
+        std::string_view line;
+        while (token.empty() && lines.next(line)) {
+            tokens = Tokenizer(line);
+            token = tokens.next();
+        }
+        double value;
+        if (token.empty() || !parseNumber(token, value)) {
+            throw std::runtime_error("PLY: bad or missing value in the body");
+        }
+        return value;
+    }
+};
+
+// Values of a binary body
+class PLYBinarySource {
+private:
+    ByteReader bytes;
+    bool bigEndian;
+
+public:
+    PLYBinarySource(std::istream &in, bool bigEndian) : bytes(in), bigEndian(bigEndian) {}
+
+    double next(PLYType type) {
+        unsigned char raw[8];
+        size_t size = plyTypeSize(type);
+        if (!bytes.read(raw, size)) {
+            throw std::runtime_error("PLY: the body is truncated");
+        }
+        // native order from here on
+        uint16_t probe = 1;
+        bool nativeLittle = *reinterpret_cast<unsigned char *>(&probe) == 1;
+        if (bigEndian == nativeLittle) {
+            std::reverse(raw, raw + size);
+        }
+        switch (type) {
+            case INT8: { int8_t v; std::memcpy(&v, raw, 1); return v; }
+            case UINT8: { uint8_t v; std::memcpy(&v, raw, 1); return v; }
+            case INT16: { int16_t v; std::memcpy(&v, raw, 2); return v; }
+            case UINT16: { uint16_t v; std::memcpy(&v, raw, 2); return v; }
+            case INT32: { int32_t v; std::memcpy(&v, raw, 4); return v; }
+            case UINT32: { uint32_t v; std::memcpy(&v, raw, 4); return v; }
+            case FLOAT32: { float v; std::memcpy(&v, raw, 4); return v; }
+            default: { double v; std::memcpy(&v, raw, 8); return v; }
+        }
+    }
+};
+
+template <typename Source>
+size_t readPLYBody(Source &source, const std::vector<PLYElement> &elements, size_t batchPolygons,
+                   const BatchConsumer &consumer) {
+    std::vector<Point3D> positions;
+    PolygonBatch batch;
+    std::vector<Point3D> face;
+    size_t count = 0;
+    for (const auto &element: elements) {
+        auto findProperty = [&element](std::initializer_list<const char *> names) {
+            for (size_t i = 0; i < element.properties.size(); ++i) {
+                for (const char *name: names) {
+                    if (element.properties[i].name == name) {
+                        return i;
+                    }
+                }
+            }
+            return element.properties.size();
+        };
+        bool isVertex = element.name == "vertex", isFace = element.name == "face";
+        size_t x = findProperty({"x"}), y = findProperty({"y"}), z = findProperty({"z"});
+        size_t indices = findProperty({"vertex_indices", "vertex_index"});
+        if (isVertex && (x == element.properties.size() || y == element.properties.size() ||
+                         z == element.properties.size())) {
+            throw std::runtime_error("PLY: the vertex element has no x, y, z");
+        }
+        if (isFace && (indices == element.properties.size() || !element.properties[indices].isList)) {
+            throw std::runtime_error("PLY: the face element has no vertex_indices list");
+        }
+        if (isVertex) {
+            positions.reserve(element.count);
+        }
+
+        for (size_t item = 0; item < element.count; ++item) {
+            double coordinates[3] = {0, 0, 0};
+            face.clear();
+            for (size_t i = 0; i < element.properties.size(); ++i) {
+                const auto &property = element.properties[i];
+                if (!property.isList) {
+                    double value = source.next(property.type);
+                    if (isVertex && (i == x || i == y || i == z)) {
+                        coordinates[i == x ? 0 : i == y ? 1 : 2] = value;
+                    }
+                    continue;
+                }
+                auto listSize = static_cast<size_t>(source.next(property.countType));
+                for (size_t j = 0; j < listSize; ++j) {
+                    double value = source.next(property.type);
+                    if (isFace && i == indices) {
+                        if (value < 0 || value >= static_cast<double>(positions.size())) {
+                            throw std::runtime_error("PLY: face " + std::to_string(item) + " has a vertex index out of range");
+                        }
+                        face.push_back(positions[static_cast<size_t>(value)]);
+                    }
+                }
+            }
+            if (isVertex) {
+                positions.emplace_back(coordinates[0], coordinates[1], coordinates[2]);
+            } else if (isFace && face.size() >= 3) {
+                batch.add(face.data(), face.size());
+                count++;
+                deliver(batch, batchPolygons, consumer, false);
+            }
+        }
+    }
+    deliver(batch, batchPolygons, consumer, true);
+    return count;
+}
+
+} // namespace
+
+size_t readOBJ(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer) {
+    batchPolygons = std::max<size_t>(batchPolygons, 1);
+    std::vector<Point3D> positions;
+    PolygonBatch batch;
+    std::vector<Point3D> face;
+    size_t count = 0, lineNumber = 0;
+    LineReader lines(in);
+    std::string_view line;
+    while (lines.next(line)) {
+        lineNumber++;
+        Tokenizer tokens(line);
+        auto keyword = tokens.next();
+        if (keyword == "v") {
+            double coordinates[3];
+            for (double &coordinate: coordinates) {
+                if (!parseNumber(tokens.next(), coordinate)) {
+                    throw parseError("OBJ", lineNumber, "bad vertex");
+                }
+            }
+            positions.emplace_back(coordinates[0], coordinates[1], coordinates[2]);
+        } else if (keyword == "f") {
+            face.clear();
+            for (auto token = tokens.next(); !token.empty(); token = tokens.next()) {
+                // i, i/t, i/t/n or i//n: only the position index matters
+                long long index;
+                if (!parseNumber(token.substr(0, token.find('/')), index) || index == 0) {
+                    throw parseError("OBJ", lineNumber, "bad face index");
+                }
+                // negative indices count back from the last vertex read
+                index = index > 0 ? index - 1 : static_cast<long long>(positions.size()) + index;
+                if (index < 0 || index >= static_cast<long long>(positions.size())) {
+                    throw parseError("OBJ", lineNumber, "face index out of range");
+                }
+                face.push_back(positions[static_cast<size_t>(index)]);
+            }
+            if (face.size() >= 3) {
+                batch.add(face.data(), face.size());
+                count++;
+                deliver(batch, batchPolygons, consumer, false);
+            }
+        }
+    }
+    deliver(batch, batchPolygons, consumer, true);
+    return count;
+}
+
+size_t readSTL(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer) {
+    constexpr size_t HEADER_SIZE = 80, RECORD_SIZE = 50;
+    batchPolygons = std::max<size_t>(batchPolygons, 1);
+    ByteReader bytes(in);
+    unsigned char header[HEADER_SIZE + 4];
+    if (!bytes.read(header, sizeof(header))) {
+        throw std::runtime_error("STL: the file is too short");
+    }
+    uint32_t triangles = littleEndian32(header + HEADER_SIZE);
+
+    PolygonBatch batch;
+    unsigned char record[RECORD_SIZE];
+    for (uint32_t i = 0; i < triangles; ++i) {
+        if (!bytes.read(record, RECORD_SIZE)) {
+            throw std::runtime_error("STL: expected " + std::to_string(triangles) + " triangles, the file has " +
+                                     std::to_string(i));
+        }
+        // normal (3 floats), three vertices (3 floats each), attribute byte count
+        Point3D vertices[3];
+        for (int v = 0; v < 3; ++v) {
+            const unsigned char *xyz = record + 12 * (v + 1);
+            vertices[v] = Point3D(littleEndianFloat(xyz), littleEndianFloat(xyz + 4), littleEndianFloat(xyz + 8));
+        }
+        batch.add(vertices, 3);
+        deliver(batch, batchPolygons, consumer, false);
+    }
+    deliver(batch, batchPolygons, consumer, true);
+    return triangles;
+}
+
+size_t readPLY(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer) {
+    batchPolygons = std::max<size_t>(batchPolygons, 1);
+    std::string line;
+    if (!std::getline(in, line) || line.substr(0, 3) != "ply") {
+        throw std::runtime_error("PLY: missing 'ply' magic");
+    }
+    std::string format;
+    std::vector<PLYElement> elements;
+    size_t lineNumber = 1;
+    while (true) {
+        if (!std::getline(in, line)) {
+            throw std::runtime_error("PLY: missing end_header");
+        }
+        lineNumber++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        Tokenizer tokens(line);
+        auto keyword = tokens.next();
+        if (keyword == "end_header") {
+            break;
+        } else if (keyword == "format") {
+            format = std::string(tokens.next());
+        } else if (keyword == "element") {
+            PLYElement element;
+            element.name = std::string(tokens.next());
+            if (!parseNumber(tokens.next(), element.count)) {
+                throw parseError("PLY", lineNumber, "bad element count");
+            }
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                throw parseError("PLY", lineNumber, "property outside of an element");
+            }
+            PLYProperty property;
+            auto type = tokens.next();
+            if (type == "list") {
+                property.isList = true;
+                property.countType = plyType(std::string(tokens.next()));
+                type = tokens.next();
+            }
+            property.type = plyType(std::string(type));
+            property.name = std::string(tokens.next());
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    if (format == "ascii") {
+        PLYAsciiSource source(in);
+        return readPLYBody(source, elements, batchPolygons, consumer);
+    } else if (format == "binary_little_endian" || format == "binary_big_endian") {
+        PLYBinarySource source(in, format == "binary_big_endian");
+        return readPLYBody(source, elements, batchPolygons, consumer);
+    }
+    throw std::runtime_error("PLY: unknown format " + format);
+}
+
+size_t readMesh(const std::string &path, size_t batchPolygons, const BatchConsumer &consumer) {
+    std::string extension = path.substr(std::min(path.rfind('.'), path.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    if (extension == ".obj") {
+        return readOBJ(file, batchPolygons, consumer);
+    } else if (extension == ".stl") {
+        return readSTL(file, batchPolygons, consumer);
+    } else if (extension == ".ply") {
+        return readPLY(file, batchPolygons, consumer);
+    }
+    throw std::runtime_error("Unknown mesh format: " + path);
+}
+
+size_t readMeshAsync(const std::string &path, size_t batchPolygons, const BatchConsumer &consumer) {
+    // one batch being parsed, up to MAX_WAITING parsed ones and one being consumed
+    constexpr size_t MAX_WAITING = 2;
+    struct Cancelled {};
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<PolygonBatch> waiting;
+    bool parsed = false, cancelled = false;
+    std::exception_ptr parserError;
+    size_t count = 0;
+
+    std::thread parser([&] {
+        try {
+            count = readMesh(path, batchPolygons, [&](PolygonBatch &batch) {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return waiting.size() < MAX_WAITING || cancelled; });
+                if (cancelled) {
+                    throw Cancelled();
+                }
+                waiting.push_back(std::move(batch));
+                changed.notify_all();
+            });
+        } catch (const Cancelled &) {
+        } catch (...) {
+            parserError = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        parsed = true;
+        changed.notify_all();
+    });
+
+    try {
+        while (true) {
+            PolygonBatch batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !waiting.empty() || parsed; });
+                if (waiting.empty()) {
+                    break;
+                }
+                batch = std::move(waiting.front());
+                waiting.pop_front();
+                changed.notify_all();
+            }
+            consumer(batch);
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cancelled = true;
+        }
+        changed.notify_all();
+        parser.join();
+        throw;
+    }
+    parser.join();
+    if (parserError) {
+        std::rethrow_exception(parserError);
+    }
+    return count;
+}
+
+size_t buildMesh(const std::string &path, BSPTree &tree, const SplitterSelector &selector, size_t batchPolygons) {
+    std::vector<Polygon> polygons;
+    size_t count = readMeshAsync(path, batchPolygons, [&polygons](PolygonBatch &batch) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            polygons.push_back(batch.getPolygon(i));
+        }
+    });
+    tree.build(std::move(polygons), selector);
+    return count;
+}
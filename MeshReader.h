@@ -0,0 +1,71 @@
+#ifndef MESH_READER_H
+#define MESH_READER_H
+
+#include "DataType.h"
+#include "Point.h"
+#include "Plane.h"
+#include "BSPTree.h"
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Polygons read from a mesh file, as a vertex pool: polygon i has the vertices [offsets[i], offsets[i + 1])
+struct PolygonBatch {
+    std::vector<Point3D> vertices;
+    std::vector<uint32_t> offsets = {0};
+
+    size_t size() const { return offsets.size() - 1; }
+    bool empty() const { return offsets.size() == 1; }
+    void clear() {
+        vertices.clear();
+        offsets.assign(1, 0);
+    }
+
+    void add(const Point3D *points, size_t count) {
+        vertices.insert(vertices.end(), points, points + count);
+        offsets.push_back(static_cast<uint32_t>(vertices.size()));
+    }
+
+    const Point3D *getVertices(size_t index) const { return vertices.data() + offsets[index]; }
+    size_t getVerticesCount(size_t index) const { return offsets[index + 1] - offsets[index]; }
+    Polygon getPolygon(size_t index, const Polygon::allocator_type &allocator = {}) const {
+        return Polygon(getVertices(index), getVerticesCount(index), allocator);
+    }
+};
+
+// Receives every batch of polygons read. It may take the contents of the batch (swap them out),
+// the reader clears it afterwards anyway
+using BatchConsumer = std::function<void(PolygonBatch &)>;
+
+// Streaming readers: the file is parsed in chunks and handed over in batches of 'batchPolygons'
+// polygons, so the reader holds one batch of faces at a time. OBJ and PLY faces index a shared
+// vertex list, which is kept (positions only) for the whole file. Faces with less than three
+// vertices are skipped. Malformed input throws std::runtime_error. They return the polygons read
+//
+// OBJ: 'v' and 'f' lines (i, i/t, i/t/n, i//n and negative indices), everything else is ignored
+size_t readOBJ(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer);
+
+// Binary STL: one triangle per record, the stored normals are ignored (the winding gives them)
+size_t readSTL(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer);
+
+// PLY, ascii or binary (little or big endian): x, y, z of the vertex element and the vertex_indices
+// (or vertex_index) list of the face element. Other elements and properties are skipped
+size_t readPLY(std::istream &in, size_t batchPolygons, const BatchConsumer &consumer);
+
+// Reader picked by the extension of 'path' (.obj, .stl or .ply, any case)
+size_t readMesh(const std::string &path, size_t batchPolygons, const BatchConsumer &consumer);
+
+// readMesh on a background thread: the calling thread runs 'consumer' on each batch while the
+// next one is being parsed, with at most two batches waiting. Exceptions of either side are
+// rethrown here, after the parser stopped
+size_t readMeshAsync(const std::string &path, size_t batchPolygons, const BatchConsumer &consumer);
+
+// Replace the contents of 'tree' with a tree built from every polygon of a mesh file at once
+// (BSPTree::build): the batches are turned into polygons while the next ones are parsed
+// (readMeshAsync), so all the faces of the file are in memory before the build
+size_t buildMesh(const std::string &path, BSPTree &tree, const SplitterSelector &selector = balancedSplitter(),
+                 size_t batchPolygons = 65536);
+
+#endif // MESH_READER_H
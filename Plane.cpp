@@ -2,63 +2,167 @@
 // Created by Joaquin on 5/09/24.
 //
 #include "Plane.h"
+#include "Classification.h"
 
 Vector3D Polygon::getNormal() const {
-    // use third vertex as reference point
-    auto p0 = Vector3D(vertices[0] - vertices[2]);
-    auto p1 = Vector3D(vertices[1] - vertices[2]);
-    return p0.crossProduct(p1);
+    // Newell's method: robust when some consecutive vertices are collinear
+    NType x = 0, y = 0, z = 0;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const auto &current = vertices[i];
+        const auto &next = vertices[nextVertexIndex(i)];
+        x += (current.getY() - next.getY()) * (current.getZ() + next.getZ());
+        y += (current.getZ() - next.getZ()) * (current.getX() + next.getX());
+        z += (current.getX() - next.getX()) * (current.getY() + next.getY());
+    }
+    return Vector3D(x, y, z);
 }
 
 RelationType Polygon::relationWithPlane(const Plane &plane) const {
-    size_t posCnt = 0, negCnt = 0, zCnt = 0;
-    for (size_t i = 0; i < vertices.size(); ++i) {
-        auto normalProduct = plane.getNormal().dotProduct(getVertex(i) - plane.getPoint());
-        if (normalProduct > 0) {
-            posCnt++;
-        } else if (normalProduct < 0) {
-            negCnt++;
-        } else {
-            zCnt++;
+    return classifyPolygon(vertexData(vertices.data()), vertices.size(), plane.getEquation(), CLASSIFY_EPSILON);
+}
+
+std::pair<Polygon, Polygon> Polygon::split(const Plane &plane) const {
+    std::pair<Polygon, Polygon> parts;
+    split(plane, parts.first, parts.second);
+    return parts;
+}
+
+void Polygon::split(const Plane &plane, Polygon &front, Polygon &back) const {
+    size_t numVertices = vertices.size();
+
+    // signed distances of the vertices, on the stack for the usual polygons
+    double inlineDistances[INLINE_VERTICES];
+    std::vector<double> heapDistances;
+    double *distances = inlineDistances;
+    if (numVertices > INLINE_VERTICES) {
+        heapDistances.resize(numVertices);
+        distances = heapDistances.data();
+    }
+    const double *xyz = vertexData(vertices.data());
+    planeDistances(xyz, numVertices, plane.getEquation(), distances);
+
+    // a convex polygon gains at most one vertex on each side
+    front.vertices.clear();
+    back.vertices.clear();
+    front.id = back.id = id;
+    front.vertices.reserve(numVertices + 1);
+    back.vertices.reserve(numVertices + 1);
+    for (size_t i = 0; i < numVertices; ++i) {
+        size_t next = nextVertexIndex(i);
+        bool inFront = distances[i] > CLASSIFY_EPSILON, behind = distances[i] < -CLASSIFY_EPSILON;
+        bool nextInFront = distances[next] > CLASSIFY_EPSILON, nextBehind = distances[next] < -CLASSIFY_EPSILON;
+        // vertices on the plane belong to both parts
+        if (!behind) {
+            front.vertices.push_back(vertices[i]);
+        }
+        if (!inFront) {
+            back.vertices.push_back(vertices[i]);
+        }
+        // strictly opposite sides mean plane intersection, at the point where the distance is zero
+        if ((inFront && nextBehind) || (behind && nextInFront)) {
+            double t = distances[i] / (distances[i] - distances[next]);
+            const double *a = xyz + 3 * i;
+            const double *b = xyz + 3 * next;
+            Point3D intersectionPoint(a[0] + (b[0] - a[0]) * t, a[1] + (b[1] - a[1]) * t, a[2] + (b[2] - a[2]) * t);
+            front.vertices.push_back(intersectionPoint);
+            back.vertices.push_back(intersectionPoint);
         }
     }
-    if (zCnt == vertices.size()) {
-        return COINCIDENT;
-    } else if (posCnt + zCnt == vertices.size()) {
-        return IN_FRONT;
-    } else if (negCnt + zCnt == vertices.size()) {
-        return BEHIND;
-    } else {
-        return SPLIT;
+}
+
+NType Polygon::area() const {
+    // Newell's normal is twice the area vector
+    return getNormal().mag() / 2;
+}
+
+Point3D Polygon::getCentroid() const {
+    Vector3D sum;
+    for (const auto &vertex: vertices) {
+        sum += Vector3D(vertex);
     }
+    return sum / NType(static_cast<double>(vertices.size()));
 }
 
-std::pair<Polygon, Polygon> Polygon::split(const Plane &plane) const {
+bool Polygon::contains(const Point3D &p) const {
+    // degenerate polygons (no area) contain nothing
+    auto normal = getNormal();
+    auto normalMag = normal.mag();
+    if (normalMag == 0) {
+        return false;
+    }
+    normal /= normalMag;
+    return contains(p, normal);
+}
+
+bool Polygon::contains(const Point3D &p, const Vector3D &normal) const {
+    // the point must lie on the plane of the polygon
+    if (normal.dotProduct(p - vertices[2]) != 0) {
+        return false;
+    }
+    // and on the inner side of every edge (convex polygon)
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        auto edge = Vector3D(getVertex(nextVertexIndex(i)) - getVertex(i));
+        auto edgeMag = edge.mag();
+        if (edgeMag == 0) {
+            continue;
+        }
+        auto toPoint = Vector3D(p - getVertex(i));
+        if (normal.dotProduct(edge.crossProduct(toPoint)) / edgeMag < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Point3D Polygon::closestPoint(const Point3D &p) const {
+    const double *xyz = vertexData(vertices.data());
+    const double point[3] = {p.getX().getValue(), p.getY().getValue(), p.getZ().getValue()};
     size_t numVertices = vertices.size();
-    std::map<size_t, Point3D> intersectionPoints;
-    std::vector<NType> products;
-    std::vector<Point3D> polyPtsPos, polyPtsNeg;
-    for (size_t i = 0; i < numVertices; ++i) {
-        auto normalProduct = plane.getNormal().dotProduct(getVertex(i) - plane.getPoint());
-        products.push_back(normalProduct);
+
+    // the projection on the plane, when it is on the inner side of every edge
+    Plane plane = getPlane();
+    const double *n = plane.getEquation();
+    double distance = n[0] * point[0] + n[1] * point[1] + n[2] * point[2] + n[3];
+    double projected[3] = {point[0] - n[0] * distance, point[1] - n[1] * distance, point[2] - n[2] * distance};
+    bool inside = n[0] != 0 || n[1] != 0 || n[2] != 0;
+    for (size_t i = 0; i < numVertices && inside; ++i) {
+        const double *a = xyz + 3 * i, *b = xyz + 3 * nextVertexIndex(i);
+        double edge[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        double toPoint[3] = {projected[0] - a[0], projected[1] - a[1], projected[2] - a[2]};
+        double side = n[0] * (edge[1] * toPoint[2] - edge[2] * toPoint[1]) +
+                      n[1] * (edge[2] * toPoint[0] - edge[0] * toPoint[2]) +
+                      n[2] * (edge[0] * toPoint[1] - edge[1] * toPoint[0]);
+        inside = side >= 0;
     }
+    if (inside) {
+        return Point3D(projected[0], projected[1], projected[2]);
+    }
+
+    // otherwise the closest point is on the boundary: the nearest of the closest points of the edges
+    double best[3] = {xyz[0], xyz[1], xyz[2]}, bestDistance = std::numeric_limits<double>::infinity();
     for (size_t i = 0; i < numVertices; ++i) {
-        if (products[i] > 0) {
-            polyPtsPos.push_back(getVertex(i));
-        } else {
-            polyPtsNeg.push_back(getVertex(i));
+        const double *a = xyz + 3 * i, *b = xyz + 3 * nextVertexIndex(i);
+        double edge[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+        double edgeLength = edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2];
+        double t = 0;
+        if (edgeLength > 0) {
+            t = ((point[0] - a[0]) * edge[0] + (point[1] - a[1]) * edge[1] + (point[2] - a[2]) * edge[2]) / edgeLength;
+            t = std::min(std::max(t, 0.0), 1.0);
         }
-        // different signs mean plane intersection
-        if (products[i] * products[nextVertexIndex(i)] < 0) {
-            auto intersectionPoint = plane.intersect(Line(getVertex(i), getVertex(nextVertexIndex(i))));
-            polyPtsPos.push_back(intersectionPoint);
-            polyPtsNeg.push_back(intersectionPoint);
+        double candidate[3] = {a[0] + edge[0] * t, a[1] + edge[1] * t, a[2] + edge[2] * t};
+        double candidateDistance = (point[0] - candidate[0]) * (point[0] - candidate[0]) +
+                                   (point[1] - candidate[1]) * (point[1] - candidate[1]) +
+                                   (point[2] - candidate[2]) * (point[2] - candidate[2]);
+        if (candidateDistance < bestDistance) {
+            bestDistance = candidateDistance;
+            std::copy(candidate, candidate + 3, best);
         }
     }
-    return {Polygon(polyPtsPos), Polygon(polyPtsNeg)};
+    return Point3D(best[0], best[1], best[2]);
 }
 
 Plane Polygon::getPlane() const {
+    // Plane normalizes the normal, so that the epsilon of the side tests is a distance
     return Plane(vertices[2], getNormal());
 }
 
@@ -73,18 +177,33 @@ bool Polygon::operator==(const Polygon &other) const {
 
 
 
+void Plane::updateEquation() {
+    auto normalMag = _n.mag();
+    if (normalMag != 0) {
+        _n /= normalMag;
+    }
+    _d = -_n.dotProduct(_p);
+    _equation[0] = _n.getX().getValue();
+    _equation[1] = _n.getY().getValue();
+    _equation[2] = _n.getZ().getValue();
+    _equation[3] = _d.getValue();
+}
+
 Point3D Plane::intersect(const Line &l) const {
     auto v = l.getUnit();
     auto p0 = Vector3D(l.getPoint());
-    auto r0 = Vector3D(getPoint());
-    auto n = getNormal();
-    NType t = n.dotProduct(r0 - p0) / n.dotProduct(v);
+    NType t = -distance(p0) / _n.dotProduct(v);
     return Point3D(p0 + (v * t));
 }
 
-bool Plane::inPositiveSide(const Point3D &point) const {
-    auto normalProduct = getNormal().dotProduct(point);
-    return normalProduct > 0;
+bool Plane::contains(const Line &l) const {
+    return contains(l.getPoint()) && _n.dotProduct(l.getUnit()) == 0;
 }
 
+bool Plane::operator==(const Plane &other) const {
+    return _n == other._n && _d == other._d;
+}
 
+bool Plane::operator!=(const Plane &other) const {
+    return !(*this == other);
+}
@@ -4,29 +4,38 @@
 #include "DataType.h"
 #include "Point.h"
 #include "Line.h"
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <map>
+#include <memory_resource>
 
 std::ostream &operator<<(std::ostream &os, const RelationType &type);
 
 class Plane {
 private:
     Point3D _p;
-    Vector3D _n;
+    Vector3D _n;        // unit normal (zero for degenerate planes)
+    NType _d;           // offset: n·x + d is the signed distance of x
+    double _equation[4];    // (nx, ny, nz, d) as raw doubles, for the classification kernels
+
+    void updateEquation();
 
 public:
-    Plane(const Point3D &point, const Vector3D &normal) : _p(point), _n(normal) {}
+    // The normal may have any length, it is normalized here
+    Plane(const Point3D &point, const Vector3D &normal) : _p(point), _n(normal) { updateEquation(); }
 
-    NType distance(const Point3D &p) const;
+    // Signed distance from the plane, positive in front
+    NType distance(const Point3D &p) const { return _n.dotProduct(p) + _d; }
 
     Point3D intersect(const Line &l) const;
 
     // Contain
-    bool contains(const Point3D &p) const;
+    bool contains(const Point3D &p) const { return distance(p) == 0; }
 
     bool contains(const Line &l) const;
 
-    bool inPositiveSide(const Point3D &point) const;
+    bool inPositiveSide(const Point3D &point) const { return distance(point) > 0; }
 
 
     // Getters
@@ -34,10 +43,14 @@ public:
 
     Vector3D getNormal() const { return _n; }
 
+    NType getOffset() const { return _d; }
+
+    const double *getEquation() const { return _equation; }
+
     // Setters
-    void setPoint(Point3D point) { _p = point; }
+    void setPoint(Point3D point) { _p = point; updateEquation(); }
 
-    void setNormal(Vector3D normal) { _n = normal; }
+    void setNormal(Vector3D normal) { _n = normal; updateEquation(); }
 
     // Operators
     bool operator==(const Plane &other) const;
@@ -51,31 +64,68 @@ public:
     }
 };
 
+// Handle of a polygon inserted in a BSPTree, shared by all the fragments it is split into
+using PolygonId = uint32_t;
+constexpr PolygonId NO_POLYGON_ID = 0xFFFFFFFFu;
+
 class Polygon {
 private:
-    std::vector<Point3D> vertices;
+    std::pmr::vector<Point3D> vertices;
+    PolygonId id = NO_POLYGON_ID;
 
 
 public:
-    Polygon(const std::vector<Point3D> &vertices) : vertices(vertices) {}
+    // Polygons of up to this many vertices are split without allocating (see SplitBuffer)
+    static constexpr size_t INLINE_VERTICES = 8;
+
+    // Allocator aware: a polygon stored in a container with a memory resource (the arena of a
+    // tree) keeps its vertices in that same resource
+    using allocator_type = std::pmr::polymorphic_allocator<Point3D>;
+
+    explicit Polygon(const allocator_type &allocator = {}) : vertices(allocator) {}
+    Polygon(const std::vector<Point3D> &vertices, const allocator_type &allocator = {})
+            : vertices(vertices.begin(), vertices.end(), allocator) {}
+    Polygon(const Point3D *vertices, size_t count, const allocator_type &allocator = {})
+            : vertices(vertices, vertices + count, allocator) {}
+    Polygon(const Polygon &other) = default;
+    Polygon(Polygon &&other) = default;
+    Polygon(const Polygon &other, const allocator_type &allocator) : vertices(other.vertices, allocator), id(other.id) {}
+    Polygon(Polygon &&other, const allocator_type &allocator)
+            : vertices(std::move(other.vertices), allocator), id(other.id) {}
+    Polygon &operator=(const Polygon &other) = default;
+    Polygon &operator=(Polygon &&other) = default;
 
     // Getters
-    std::vector<Point3D> getVertices() const { return vertices; }
+    const std::pmr::vector<Point3D> &getVertices() const { return vertices; }
 
     size_t nextVertexIndex(size_t index) const { return (index + 1) % vertices.size(); }
 //    Point3D getNextVertex(size_t index) const { return getVertex(n); }
 
     Point3D getVertex(size_t index) const { return vertices[index]; }
 
+    PolygonId getId() const { return id; }    // Set by the tree the polygon was inserted in
+    void setId(PolygonId id) { this->id = id; }
+
     Plane getPlane() const;    // Get the plane of the polygon
     Vector3D getNormal() const;    // Get the normal of the polygon
     Point3D getCentroid() const;    // Get the centroid of the polygon
+    bool isDegenerate() const { return getNormal().mag() == 0; }    // No area, hence no plane
 
     // Setters
-    void setVertices(std::vector<Point3D> vertices) { this->vertices = vertices; }
+    void setVertices(const std::vector<Point3D> &vertices) { this->vertices.assign(vertices.begin(), vertices.end()); }
+    void setVertices(const Point3D *vertices, size_t count) { this->vertices.assign(vertices, vertices + count); }
+
+    // Reverse the winding, which turns the normal (and the plane) around
+    void flip() { std::reverse(vertices.begin(), vertices.end()); }
 
-    // Check if a point is inside the polygon
+    // Check if a point is inside the polygon (convex polygons only)
     bool contains(const Point3D &p) const;
+    // The same given the unit normal of the (not degenerate) polygon, for testing many points
+    bool contains(const Point3D &p, const Vector3D &normal) const;
+
+    // Point of the polygon nearest to p (convex polygons only): the projection of p on the plane
+    // when it falls inside the polygon, the nearest point of the edges otherwise
+    Point3D closestPoint(const Point3D &p) const;
 
     // Get the relation of the polygon with a plane
     RelationType relationWithPlane(const Plane &plane) const;
@@ -84,6 +134,11 @@ public:
     // Split the polygon by a plane
     std::pair<Polygon, Polygon> split(const Plane &plane) const;
 
+    // Split the polygon by a plane into 'front' and 'back', reusing their storage (and memory
+    // resource). Both parts keep the id. Nothing else is allocated for polygons of up to
+    // INLINE_VERTICES vertices
+    void split(const Plane &plane, Polygon &front, Polygon &back) const;
+
     // Compute the area of the polygon
     NType area() const;
 
@@ -102,5 +157,33 @@ public:
     }
 };
 
+// Scratch polygons for split results, stored inside the object (on the stack) while the split
+// polygon has at most Polygon::INLINE_VERTICES vertices, which covers triangles and quads. Every
+// split starts again from the beginning of the storage, so a loop of splits never allocates;
+// bigger polygons fall back to 'upstream'. Copy the parts out, never move them: a move would
+// keep pointing here
+class SplitBuffer {
+private:
+    // each part of a convex polygon gains at most one vertex
+    alignas(Point3D) unsigned char storage[2 * (Polygon::INLINE_VERTICES + 1) * sizeof(Point3D)];
+    std::pmr::monotonic_buffer_resource resource;
+
+public:
+    Polygon front, back;
+
+    explicit SplitBuffer(std::pmr::memory_resource *upstream = std::pmr::get_default_resource())
+            : resource(storage, sizeof(storage), upstream), front(&resource), back(&resource) {}
+    SplitBuffer(const SplitBuffer &) = delete;
+    SplitBuffer &operator=(const SplitBuffer &) = delete;
+
+    // Split 'polygon' into front and back. The previous parts are dropped first: the resource
+    // never frees, so it is released (back to the start of the storage) once nothing uses it
+    void split(const Polygon &polygon, const Plane &plane) {
+        front = Polygon(&resource);
+        back = Polygon(&resource);
+        resource.release();
+        polygon.split(plane, front, back);
+    }
+};
 
 #endif // PLANE_H
\ No newline at end of file
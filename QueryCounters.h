@@ -0,0 +1,60 @@
+#ifndef QUERY_COUNTERS_H
+#define QUERY_COUNTERS_H
+
+#include <cstdint>
+
+// Work done by the queries of the calling thread (segment, volume and point queries of BSPTree,
+// BSPNode and CompiledBSPTree). The counting is compiled in only with BSP_ENABLE_COUNTERS: without
+// it BSP_COUNT expands to nothing and the counters stay at zero, so the query paths pay nothing.
+// Counters are per thread, without atomics; BSPQueryExecutor adds up those of its workers
+struct QueryCounters {
+    uint64_t queries = 0;       // segments, points or volumes
+    uint64_t nodesVisited = 0;  // per query: a packet of n segments reaching a node counts n
+    uint64_t planeTests = 0;    // query against a partition, or node bounds against a query plane
+    uint64_t polygonTests = 0;  // point in polygon, or polygon against a query plane
+
+    QueryCounters &operator+=(const QueryCounters &other) {
+        queries += other.queries;
+        nodesVisited += other.nodesVisited;
+        planeTests += other.planeTests;
+        polygonTests += other.polygonTests;
+        return *this;
+    }
+
+    QueryCounters operator-(const QueryCounters &other) const {
+        QueryCounters difference = *this;
+        difference.queries -= other.queries;
+        difference.nodesVisited -= other.nodesVisited;
+        difference.planeTests -= other.planeTests;
+        difference.polygonTests -= other.polygonTests;
+        return difference;
+    }
+
+    double perQuery(uint64_t counter) const {
+        return queries > 0 ? static_cast<double>(counter) / static_cast<double>(queries) : 0;
+    }
+};
+
+#ifdef BSP_ENABLE_COUNTERS
+constexpr bool QUERY_COUNTERS_ENABLED = true;
+#else
+constexpr bool QUERY_COUNTERS_ENABLED = false;
+#endif
+
+// Counters of the calling thread
+inline QueryCounters &threadQueryCounters() {
+    static thread_local QueryCounters counters;
+    return counters;
+}
+
+inline void resetQueryCounters() {
+    threadQueryCounters() = QueryCounters();
+}
+
+#ifdef BSP_ENABLE_COUNTERS
+#define BSP_COUNT(counter, amount) (threadQueryCounters().counter += (amount))
+#else
+#define BSP_COUNT(counter, amount) ((void) 0)
+#endif
+
+#endif // QUERY_COUNTERS_H
@@ -0,0 +1,96 @@
+#include "Random.h"
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+std::random_device rd;
+std::mt19937 gen(rd());
+std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+
+void seedRandom(unsigned int seed) {
+    gen.seed(seed);
+}
+
+// Funciones auxiliares para generar polígonos aleatorios
+NType randomInRange(float min, float max) {
+    return min + (max - min) * dis(gen);
+}
+
+Vector3D randomUnitVector() {
+    NType theta = randomInRange(0, 2 * M_PI);
+    NType phi = acos(randomInRange(-1.0f, 1.0f));
+    NType x = sin(phi) * cos(theta);
+    NType y = sin(phi) * sin(theta);
+    NType z = cos(phi);
+    return Vector3D(x, y, z);
+}
+
+Point3D randomPointInBox(float x_min, float x_max, float y_min, float y_max, float z_min, float z_max) {
+    NType x = randomInRange(x_min, x_max);
+    NType y = randomInRange(y_min, y_max);
+    NType z = randomInRange(z_min, z_max);
+    return Point3D(x, y, z);
+}
+std::pair<Vector3D, Vector3D> generateOrthogonalVectors(const Vector3D& v) {
+    Vector3D a = (abs(v.getX()) > abs(v.getZ())) ? Vector3D(v.getY(), -v.getX(), 0) : Vector3D(0, -v.getZ(), v.getY());
+    Vector3D b = v.crossProduct(a);
+    a.normalize();
+    b.normalize();
+    return {a, b};
+}
+// Triángulo aleatorio de radio entre 0.5 y 1.5 alrededor de P
+Polygon randomTriangleAt(const Point3D& P) {
+    std::uniform_real_distribution<float> angleDist(0, 2 * M_PI);
+    std::uniform_real_distribution<float> radiusDist(0.5, 1.5);
+
+    Vector3D v = randomUnitVector();
+    v.normalize();
+
+    // Generar vectores ortogonales u y w
+    auto [u, w] = generateOrthogonalVectors(v);
+    int numVertices = 3;
+
+    // Generar vértices en el plano
+    std::vector<Point3D> vertices;
+    NType angleIncrement = 2 * M_PI / numVertices;
+    for (int j = 0; j < numVertices; ++j) {
+        NType angle = j * angleIncrement + angleDist(gen) * (angleIncrement / 4);
+        NType radius = radiusDist(gen);
+
+        NType scale_u = radius * cos(angle);
+        NType scale_w = radius * sin(angle);
+
+        Point3D vertex = P + u * scale_u + w * scale_w;
+        vertices.push_back(vertex);
+    }
+    return Polygon(vertices);
+}
+
+std::vector<Polygon> generateRandomPolygons(int n, float x_min, float x_max, float y_min, float y_max, float z_min, float z_max) {
+    std::vector<Polygon> polygons;
+    polygons.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        polygons.push_back(randomTriangleAt(randomPointInBox(x_min, x_max, y_min, y_max, z_min, z_max)));
+    }
+    return polygons;
+}
+
+std::vector<Polygon> generateClusteredPolygons(int n, int clusters, float spread, float x_min, float x_max,
+                                               float y_min, float y_max, float z_min, float z_max) {
+    std::vector<Point3D> centers;
+    for (int i = 0; i < clusters; ++i) {
+        centers.push_back(randomPointInBox(x_min, x_max, y_min, y_max, z_min, z_max));
+    }
+    std::uniform_int_distribution<int> clusterDist(0, clusters - 1);
+    std::normal_distribution<float> offsetDist(0, spread);
+    std::vector<Polygon> polygons;
+    polygons.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        const Point3D& center = centers[clusterDist(gen)];
+        float dx = offsetDist(gen), dy = offsetDist(gen), dz = offsetDist(gen);
+        polygons.push_back(randomTriangleAt(Point3D(center.getX() + dx, center.getY() + dy, center.getZ() + dz)));
+    }
+    return polygons;
+}
@@ -0,0 +1,30 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include "DataType.h"
+#include "Point.h"
+#include "Line.h"
+#include "Plane.h"
+#include <random>
+#include <vector>
+
+// Generador compartido por las funciones auxiliares (sembrado con std::random_device)
+extern std::mt19937 gen;
+
+// Vuelve a sembrar el generador, para obtener entradas deterministas
+void seedRandom(unsigned int seed);
+
+// Funciones auxiliares para generar polígonos aleatorios
+NType randomInRange(float min, float max);
+Vector3D randomUnitVector();
+Point3D randomPointInBox(float x_min, float x_max, float y_min, float y_max, float z_min, float z_max);
+std::pair<Vector3D, Vector3D> generateOrthogonalVectors(const Vector3D& v);
+Polygon randomTriangleAt(const Point3D& P);
+std::vector<Polygon> generateRandomPolygons(int n, float x_min, float x_max, float y_min, float y_max, float z_min, float z_max);
+
+// Polígonos agrupados alrededor de 'clusters' centros uniformes en la caja, con una dispersión
+// normal de desviación 'spread' en cada eje
+std::vector<Polygon> generateClusteredPolygons(int n, int clusters, float spread, float x_min, float x_max,
+                                               float y_min, float y_max, float z_min, float z_max);
+
+#endif // RANDOM_H
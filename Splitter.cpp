@@ -0,0 +1,83 @@
+#include "Splitter.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Candidates are scored against at most this many polygons of the set, so that choosing the
+// partition of a big node costs the same as for a small one
+constexpr size_t SCORED_POLYGONS = 1024;
+
+size_t scoringStride(const std::vector<Polygon> &polygons) {
+    return std::max<size_t>(polygons.size() / SCORED_POLYGONS, 1);
+}
+
+// Evenly spaced candidates, so that builds are deterministic
+template <typename Cost>
+size_t cheapestSample(const std::vector<Polygon> &polygons, size_t samples, Cost cost) {
+    size_t candidates = std::min(std::max<size_t>(samples, 1), polygons.size());
+    size_t best = 0;
+    double bestCost = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < candidates; ++i) {
+        size_t index = i * polygons.size() / candidates;
+        double candidateCost = cost(polygons[index].getPlane());
+        if (candidateCost < bestCost) {
+            bestCost = candidateCost;
+            best = index;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+SplitterSelector firstPolygonSplitter() {
+    return [](const std::vector<Polygon> &) -> size_t { return 0; };
+}
+
+SplitterSelector balancedSplitter(size_t samples, double splitWeight, double balanceWeight) {
+    return [=](const std::vector<Polygon> &polygons) {
+        size_t stride = scoringStride(polygons);
+        return cheapestSample(polygons, samples, [&](const Plane &plane) {
+            double front = 0, back = 0, splits = 0;
+            for (size_t i = 0; i < polygons.size(); i += stride) {
+                switch (polygons[i].relationWithPlane(plane)) {
+                    case IN_FRONT: front++; break;
+                    case BEHIND: back++; break;
+                    case SPLIT: splits++; front++; back++; break;
+                    case COINCIDENT: break;
+                }
+            }
+            return splitWeight * splits + balanceWeight * std::abs(front - back);
+        });
+    };
+}
+
+SplitterSelector surfaceAreaSplitter(size_t samples, double traversalCost, double splitWeight) {
+    return [=](const std::vector<Polygon> &polygons) {
+        size_t stride = scoringStride(polygons);
+        std::vector<double> areas(polygons.size());
+        double totalArea = 0;
+        for (size_t i = 0; i < polygons.size(); i += stride) {
+            areas[i] = polygons[i].area().getValue();
+            totalArea += areas[i];
+        }
+        if (totalArea <= 0) {
+            return size_t(0);
+        }
+        return cheapestSample(polygons, samples, [&](const Plane &plane) {
+            double front = 0, back = 0, splits = 0, areaFront = 0, areaBack = 0;
+            for (size_t i = 0; i < polygons.size(); i += stride) {
+                switch (polygons[i].relationWithPlane(plane)) {
+                    case IN_FRONT: front++; areaFront += areas[i]; break;
+                    case BEHIND: back++; areaBack += areas[i]; break;
+                    // a split polygon is visited from both sides
+                    case SPLIT: splits++; front++; back++; areaFront += areas[i]; areaBack += areas[i]; break;
+                    case COINCIDENT: break;
+                }
+            }
+            return traversalCost + (areaFront / totalArea) * front + (areaBack / totalArea) * back + splitWeight * splits;
+        });
+    };
+}
@@ -0,0 +1,24 @@
+#ifndef SPLITTER_H
+#define SPLITTER_H
+
+#include "DataType.h"
+#include "Plane.h"
+#include <functional>
+#include <vector>
+
+// Chooses which polygon of a set gives the partition plane of a node (returns its index)
+using SplitterSelector = std::function<size_t(const std::vector<Polygon> &)>;
+
+// The first polygon of the set, what BSPTree::insert does (depends on input order)
+SplitterSelector firstPolygonSplitter();
+
+// Samples candidates across the set and keeps the cheapest by
+//   splitWeight * splits + balanceWeight * |front - back|
+SplitterSelector balancedSplitter(size_t samples = 16, double splitWeight = 8, double balanceWeight = 1);
+
+// Samples candidates and keeps the cheapest by a surface-area style cost for ray queries:
+//   traversalCost + (areaFront / area) * front + (areaBack / area) * back + splitWeight * splits
+// where the area of the polygons on each side estimates how likely a ray is to visit it
+SplitterSelector surfaceAreaSplitter(size_t samples = 16, double traversalCost = 1, double splitWeight = 1);
+
+#endif // SPLITTER_H
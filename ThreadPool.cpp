@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace {
+
+// Pool and deque of the calling thread, when it is a worker
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local size_t currentIndex = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads) : queued(0), stopping(false) {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 1; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleeping.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::currentQueue() const {
+    return currentPool == this ? currentIndex : 0;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    auto &queue = *queues[currentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued++;
+    }
+    sleeping.notify_one();
+}
+
+bool ThreadPool::runPendingTask() {
+    std::function<void()> task;
+    size_t own = currentQueue();
+    for (size_t i = 0; i < queues.size() && !task; ++i) {
+        auto &queue = *queues[(own + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        // LIFO on the own deque, FIFO when stealing
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task) {
+        return false;
+    }
+    queued--;
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentIndex = index;
+    while (true) {
+        if (runPendingTask()) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    pending++;
+    pool.submit([this, task = std::move(task)] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        pending--;
+    });
+}
+
+void TaskGroup::waitAll() {
+    while (pending > 0) {
+        if (!pool.runPendingTask()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskGroup::wait() {
+    waitAll();
+    if (error) {
+        auto rethrown = error;
+        error = nullptr;
+        std::rethrow_exception(rethrown);
+    }
+}
+
+void parallelFor(ThreadPool &pool, size_t first, size_t last, size_t grainSize,
+                 const std::function<void(size_t, size_t)> &body) {
+    grainSize = std::max<size_t>(grainSize, 1);
+    TaskGroup group(pool);
+    for (size_t begin = first; begin < last; begin += grainSize) {
+        size_t end = std::min(begin + grainSize, last);
+        // the calling thread keeps the last chunk
+        if (end == last) {
+            body(begin, end);
+        } else {
+            group.run([&body, begin, end] { body(begin, end); });
+        }
+    }
+    group.wait();
+}
@@ -0,0 +1,77 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.
+// Every worker owns a deque: it pushes and pops its own tasks at the back (depth first, cache
+// friendly) and, when it runs out, steals from the front of the others (the biggest, oldest tasks).
+// Threads outside the pool share one extra deque.
+class ThreadPool {
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;   // queues[0] is for threads outside the pool
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued;
+    std::atomic<bool> stopping;
+    std::mutex sleepMutex;
+    std::condition_variable sleeping;
+
+    size_t currentQueue() const;
+    void workerLoop(size_t index);
+
+public:
+    // 'threads' counts the calling thread, which works while it waits on a TaskGroup
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t getThreadsCount() const { return workers.size() + 1; }
+
+    // Queue a task (on the deque of the calling worker, if any)
+    void submit(std::function<void()> task);
+
+    // Run one queued task on the calling thread, own deque first. False if there was none
+    bool runPendingTask();
+};
+
+// Tasks that can be waited for together. wait() runs queued tasks instead of blocking, so
+// tasks may spawn and wait on nested groups. The first exception thrown by a task is rethrown
+class TaskGroup {
+private:
+    ThreadPool &pool;
+    std::atomic<size_t> pending;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+public:
+    explicit TaskGroup(ThreadPool &pool) : pool(pool), pending(0) {}
+    ~TaskGroup() { waitAll(); }
+
+    void run(std::function<void()> task);
+    void wait();
+
+private:
+    void waitAll();
+};
+
+// Calls body(begin, end) on consecutive chunks of [first, last) of at most 'grainSize' elements
+void parallelFor(ThreadPool &pool, size_t first, size_t last, size_t grainSize,
+                 const std::function<void(size_t, size_t)> &body);
+
+#endif // THREAD_POOL_H
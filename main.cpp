@@ -1,92 +1,26 @@
 #include <cassert>
 #include <vector>
-#include <random>
-#include <cmath>
 #include <algorithm>
 #include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
 #include <unordered_set>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
 #include "DataType.h"
 #include "Line.h"
 #include "Plane.h"
 #include "BSPTree.h"
-
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
-std::random_device rd;
-std::mt19937 gen(rd());
-std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-
-// Funciones auxiliares para generar polígonos aleatorios
-NType randomInRange(float min, float max) {
-    return min + (max - min) * dis(gen);
-}
-
-Vector3D randomUnitVector() {
-    NType theta = randomInRange(0, 2 * M_PI);
-    NType phi = acos(randomInRange(-1.0f, 1.0f));
-    NType x = sin(phi) * cos(theta);
-    NType y = sin(phi) * sin(theta);
-    NType z = cos(phi);
-    return Vector3D(x, y, z);
-}
-
-Point3D randomPointInBox(float x_min, float x_max, float y_min, float y_max, float z_min, float z_max) {
-    NType x = randomInRange(x_min, x_max);
-    NType y = randomInRange(y_min, y_max);
-    NType z = randomInRange(z_min, z_max);
-    return Point3D(x, y, z);
-}
-std::pair<Vector3D, Vector3D> generateOrthogonalVectors(const Vector3D& v) {
-    Vector3D a = (abs(v.getX()) > abs(v.getZ())) ? Vector3D(v.getY(), -v.getX(), 0) : Vector3D(0, -v.getZ(), v.getY());
-    Vector3D b = v.crossProduct(a);
-    a.normalize();
-    b.normalize();
-    return {a, b};
-}
-std::vector<Polygon> generateRandomPolygons(int n, float x_min, float x_max, float y_min, float y_max, float z_min, float z_max) {
-    std::vector<Polygon> polygons;
-    std::uniform_int_distribution<int> vertexCountDist(3, 6);
-    std::uniform_real_distribution<float> angleDist(0, 2 * M_PI);
-    std::uniform_real_distribution<float> radiusDist(0.5, 1.5);
-
-
-    for (int i = 0; i < n; ++i) {
-        Point3D P = randomPointInBox(x_min, x_max, y_min, y_max, z_min, z_max);
-        Vector3D v = randomUnitVector();
-        v.normalize();
-
-        // Generar vectores ortogonales u y w
-        auto [u, w] = generateOrthogonalVectors(v);
-        int numVertices = 3;//vertexCountDist(gen);
-
-        // Generar vértices en el plano
-        std::vector<Point3D> vertices;
-        NType angleIncrement = 2 * M_PI / numVertices;
-        for (int j = 0; j < numVertices; ++j) {
-            NType angle = j * angleIncrement + angleDist(gen) * (angleIncrement / 4);
-            NType radius = radiusDist(gen);
-
-            NType scale_u = radius * cos(angle);
-            NType scale_w = radius * sin(angle);
-
-            Point3D vertex = P + u * scale_u + w * scale_w;
-            vertices.push_back(vertex);
-        }
-
-        // Asegurar que los vértices son únicos y forman un polígono válido
-        if (vertices.size() >= 3) {
-            Polygon polygon(vertices);
-            polygons.push_back(polygon);
-        } else {
-            // Volver a intentar :'c
-            --i;
-        }
-    }
-    return polygons;
-}
-
+#include "ConcurrentBSPTree.h"
+#include "BSPQueryExecutor.h"
+#include "QueryCounters.h"
+#include "CompiledBSPTree.h"
+#include "Classification.h"
+#include "Random.h"
+#include "MeshReader.h"
+#include "CSG.h"
 
 // Función para verificar que los polígonos estén correctamente ubicados en el BSP-Tree
 bool verifySubtreePolygons(BSPNode* node, const Plane& parentPlane, bool shouldBeInFront, std::unordered_set<const Polygon*>& verifiedPolygons) {
@@ -241,6 +175,9 @@ void testBSPTree() {
         bspTree.insert(polygon);
     }
 
+    // Los nodos y sus polígonos viven en la arena del árbol
+    assert(bspTree.getRoot()->getResource() == bspTree.getArena().getResource() && "Error: El nodo raíz no está en la arena del árbol.");
+
     std::unordered_set<const Polygon*> verifiedPolygons;
     bool isValid = verifyBSPNode(bspTree.getRoot(), verifiedPolygons);
     assert(isValid && "Error: Algunos polígonos no están correctamente ubicados en el BSP-Tree.");
@@ -253,7 +190,1521 @@ void testBSPTree() {
     std::cout << "Todos los tests del BSP-Tree pasaron correctamente :D" << std::endl;
 }
 
+// Colisión por fuerza bruta: intersecta el segmento con cada polígono y se queda con el más cercano
+Collision bruteForceCollision(const std::vector<Polygon>& polygons, const LineSegment& segment) {
+    Collision best;
+    auto origin = segment.getP1();
+    auto direction = Vector3D(segment.getP2() - origin);
+    for (const Polygon& polygon : polygons) {
+        auto plane = polygon.getPlane();
+        auto startDist = plane.getNormal().dotProduct(origin - plane.getPoint());
+        auto endDist = plane.getNormal().dotProduct(segment.getP2() - plane.getPoint());
+        if ((startDist >= 0) == (endDist >= 0)) {
+            continue;
+        }
+        NType t = startDist.getValue() / (startDist.getValue() - endDist.getValue());
+        Point3D point = Vector3D(origin) + direction * t;
+        NType distance = direction.mag() * t;
+        if (polygon.contains(point) && (!best || distance < best.distance)) {
+            best.polygon = &polygon;
+            best.distance = distance;
+            best.point = point;
+        }
+    }
+    return best;
+}
+
+void testCollisionDetection() {
+    BSPTree bspTree;
+
+    int n_polygons = 300;
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(n_polygons, p_min, p_max, p_min, p_max, p_min, p_max);
+    for (const auto& polygon : randomPolygons) {
+        bspTree.insert(polygon);
+    }
+
+    // Segmentos desde un punto aleatorio hacia el centroide de un polígono aleatorio
+    std::uniform_int_distribution<size_t> polygonDist(0, randomPolygons.size() - 1);
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < 500; ++i) {
+        Point3D start = randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max);
+        Vector3D toTarget = Vector3D(randomPolygons[polygonDist(gen)].getCentroid() - start);
+        segments.emplace_back(start, Vector3D(start) + toTarget * 1.5);
+    }
+    // También algunos segmentos aleatorios que pueden no colisionar
+    for (int i = 0; i < 500; ++i) {
+        segments.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                              randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+    }
+
+    std::vector<Collision> batchHits = bspTree.detectCollisions(segments);
+    size_t hits = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const LineSegment& segment = segments[i];
+        Collision expected = bruteForceCollision(randomPolygons, segment);
+        Collision actual = bspTree.detectCollision(segment);
+        assert(bool(expected) == bool(actual) && "Error: La colisión del BSP-Tree no coincide con la de fuerza bruta.");
+        if (actual) {
+            assert(abs(expected.distance - actual.distance) < 1e-3 && "Error: La distancia de colisión es incorrecta.");
+            assert(actual.polygon->contains(actual.point) && "Error: El punto de colisión no está en el polígono.");
+            hits++;
+        }
+        assert(batchHits[i].polygon == actual.polygon && "Error: La colisión por lotes no coincide con la individual.");
+    }
+    assert(hits > 0 && "Error: Ningún segmento colisionó con el BSP-Tree.");
+
+    // Por paquetes: los segmentos sueltos y un haz desde un mismo ojo, en bloques de 16 x 16
+    Point3D eye(p_min + 1, (p_min + p_max) / 2.0, (p_min + p_max) / 2.0);
+    std::vector<LineSegment> bundle;
+    for (int tile = 0; tile < 4; ++tile) {
+        for (int i = 0; i < 256; ++i) {
+            int row = (tile / 2) * 16 + i / 16, column = (tile % 2) * 16 + i % 16;
+            Vector3D direction(1, (row - 15.5) / 32, (column - 15.5) / 32);
+            bundle.emplace_back(eye, Vector3D(eye) + direction * (p_max - p_min));
+        }
+    }
+    for (const auto *lines: {&segments, &bundle}) {
+        std::vector<Collision> packetHits = bspTree.detectCoherentCollisions(*lines);
+        for (size_t i = 0; i < lines->size(); ++i) {
+            Collision actual = bspTree.detectCollision((*lines)[i]);
+            assert(packetHits[i].polygon == actual.polygon && "Error: La colisión por paquetes no coincide con la individual.");
+            if (actual) {
+                assert(abs(packetHits[i].distance - actual.distance) < 1e-4 && "Error: La distancia por paquetes es incorrecta.");
+            }
+        }
+    }
+
+    std::cout << "Los tests de colisión del BSP-Tree pasaron correctamente (" << hits << " colisiones) :D" << std::endl;
+}
+
+void testCompiledBSPTree() {
+    BSPTree bspTree;
+
+    int n_polygons = 300;
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(n_polygons, p_min, p_max, p_min, p_max, p_min, p_max);
+    for (const auto& polygon : randomPolygons) {
+        bspTree.insert(polygon);
+    }
+    CompiledBSPTree compiled(bspTree);
+    assert(compiled.getPolygonsCount() == bspTree.getRoot()->getPolygonsCount() && "Error: El árbol compilado no tiene todos los polígonos.");
+
+    // Las colisiones deben coincidir con las del árbol original
+    for (int i = 0; i < 1000; ++i) {
+        LineSegment segment(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                            randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+        Collision expected = bspTree.detectCollision(segment);
+        CompiledBSPTree::Hit actual = compiled.detectCollision(segment);
+        assert(bool(expected) == bool(actual) && "Error: La colisión del árbol compilado no coincide.");
+        if (actual) {
+            assert(std::abs(expected.distance.getValue() - actual.distance) < 1e-6 && "Error: La distancia de colisión del árbol compilado es incorrecta.");
+            assert(compiled.getPolygon(actual.polygon).contains(actual.point) && "Error: El punto de colisión no está en el polígono.");
+        }
+    }
+
+    // La celda de un punto debe ser una hoja en su lado del plano
+    for (int i = 0; i < 1000; ++i) {
+        Point3D point = randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max);
+        const auto& node = compiled.getNode(compiled.locatePoint(point));
+        NType distance = Vector3D(node.plane[0], node.plane[1], node.plane[2]).dotProduct(point) + node.plane[3];
+        uint32_t next = distance >= 0 ? node.front : node.back;
+        assert(next == CompiledBSPTree::NONE && "Error: locatePoint no llegó a una hoja.");
+    }
+
+    std::cout << "Los tests del BSP-Tree compilado pasaron correctamente :D" << std::endl;
+}
+
+void testCompiledBSPTreeFile() {
+    BSPTree bspTree;
+
+    int p_min = 0, p_max = 20;
+    bspTree.build(generateRandomPolygons(500, p_min, p_max, p_min, p_max, p_min, p_max));
+    CompiledBSPTree compiled(bspTree);
+
+    std::string path = (std::filesystem::temp_directory_path() / "bsptree_test.bsp").string();
+    compiled.save(path);
+    CompiledBSPTree loaded = CompiledBSPTree::load(path);
+    assert(loaded.getNodesCount() == compiled.getNodesCount() && loaded.getPolygonsCount() == compiled.getPolygonsCount() &&
+           loaded.getVerticesCount() == compiled.getVerticesCount() && "Error: El árbol cargado no tiene el mismo tamaño.");
+
+    // Las consultas sobre el archivo mapeado deben dar lo mismo que sobre el árbol compilado
+    CompiledBSPTree copy = loaded;
+    for (int i = 0; i < 1000; ++i) {
+        LineSegment segment(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                            randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+        CompiledBSPTree::Hit expected = compiled.detectCollision(segment);
+        CompiledBSPTree::Hit actual = copy.detectCollision(segment);
+        assert(expected.polygon == actual.polygon && expected.distance == actual.distance && "Error: La colisión del árbol cargado no coincide.");
+        Point3D point = randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max);
+        assert(compiled.locatePoint(point) == copy.locatePoint(point) && "Error: locatePoint del árbol cargado no coincide.");
+    }
+
+    // Un árbol vacío también se puede guardar
+    CompiledBSPTree().save(path);
+    assert(CompiledBSPTree::load(path).isEmpty() && "Error: El árbol vacío cargado no está vacío.");
+
+    // Archivos que no son árboles o están truncados
+    auto loadFails = [&path]() {
+        try {
+            CompiledBSPTree::load(path);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "esto no es un árbol BSP, solo texto de relleno para superar el tamaño de la cabecera";
+    }
+    assert(loadFails() && "Error: Se cargó un archivo que no es un árbol.");
+    compiled.save(path);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    assert(loadFails() && "Error: Se cargó un archivo truncado.");
+
+    // Archivos con índices corruptos: se detectan al cargar, no en las consultas
+    using Header = CompiledBSPTree::FileHeader;
+    auto corrupt = [&](auto field, uint64_t value, size_t bytes) {
+        compiled.save(path);
+        Header header{};
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        file.seekp(static_cast<std::streamoff>(field(header)));
+        file.write(reinterpret_cast<const char*>(&value), static_cast<std::streamsize>(bytes));
+    };
+    uint64_t nodeBytes = sizeof(CompiledBSPTree::Node), recordBytes = sizeof(CompiledBSPTree::PolygonRecord);
+    uint32_t root = compiled.getNode(0).front != CompiledBSPTree::NONE ? offsetof(CompiledBSPTree::Node, front)
+                                                                        : offsetof(CompiledBSPTree::Node, back);
+    corrupt([&](const Header& h) { return h.nodesOffset + root; }, 0, sizeof(uint32_t));
+    assert(loadFails() && "Error: Se cargó un nodo que es su propio hijo.");
+    corrupt([&](const Header& h) { return h.nodesOffset + root; }, compiled.getNodesCount(), sizeof(uint32_t));
+    assert(loadFails() && "Error: Se cargó un hijo fuera del arreglo de nodos.");
+    corrupt([&](const Header& h) { return h.nodesOffset + (compiled.getNodesCount() - 1) * nodeBytes +
+                                          offsetof(CompiledBSPTree::Node, firstPolygon); },
+            compiled.getPolygonsCount() + 1, sizeof(uint32_t));
+    assert(loadFails() && "Error: Se cargó un rango de polígonos fuera del arreglo.");
+    corrupt([&](const Header& h) { return h.polygonsOffset + (compiled.getPolygonsCount() - 1) * recordBytes +
+                                          offsetof(CompiledBSPTree::PolygonRecord, vertexCount); },
+            0xFFFFFFu, sizeof(uint32_t));
+    assert(loadFails() && "Error: Se cargó un rango de vértices fuera del arreglo.");
+    corrupt([](const Header&) { return offsetof(Header, verticesCount); }, 3 * compiled.getVerticesCount() - 1, sizeof(uint64_t));
+    assert(loadFails() && "Error: Se cargó un número de coordenadas que no es múltiplo de 3.");
+    std::filesystem::remove(path);
+    assert(loadFails() && "Error: Se cargó un archivo que no existe.");
+
+    std::cout << "Los tests de guardado y carga del BSP-Tree compilado pasaron correctamente :D" << std::endl;
+}
+
+void testCompiledBSPTree32() {
+    BSPTree bspTree;
+    int p_min = 0, p_max = 20;
+    bspTree.build(generateRandomPolygons(500, p_min, p_max, p_min, p_max, p_min, p_max));
+    CompiledBSPTree compiled(bspTree);
+    CompiledBSPTree32 compiled32(bspTree);
+    assert(compiled32.getNodesCount() == compiled.getNodesCount() && compiled32.getPolygonsCount() == compiled.getPolygonsCount() &&
+           "Error: El árbol de 32 bits no tiene la misma forma.");
+    assert(compiled32.memoryBytes() < compiled.memoryBytes() * 0.6 && "Error: El árbol de 32 bits debe ocupar cerca de la mitad.");
+    assert(compiled.getTolerance() == CompiledBSPTree::EPSILON && compiled32.getTolerance() > CompiledBSPTree32::EPSILON &&
+           compiled32.getTolerance() < 1e-4 && "Error: La tolerancia del árbol de 32 bits no depende de la escena.");
+
+    // Solo difieren los segmentos que pasan a menos de la tolerancia de un borde o de un plano
+    size_t segments = 2000, mismatches = 0;
+    for (size_t i = 0; i < segments; ++i) {
+        LineSegment segment(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                            randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+        CompiledBSPTree::Hit expected = compiled.detectCollision(segment);
+        CompiledBSPTree32::Hit actual = compiled32.detectCollision(segment);
+        if (expected.polygon != actual.polygon) {
+            mismatches++;
+            continue;
+        }
+        if (actual) {
+            assert(std::abs(expected.distance - actual.distance) < 1e-3 && "Error: La distancia del árbol de 32 bits es incorrecta.");
+        }
+    }
+    assert(mismatches <= segments / 100 && "Error: El árbol de 32 bits difiere en demasiadas colisiones.");
+    size_t cellMismatches = 0;
+    for (int i = 0; i < 2000; ++i) {
+        Point3D point = randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max);
+        cellMismatches += compiled.locatePoint(point) != compiled32.locatePoint(point);
+    }
+    assert(cellMismatches <= 20 && "Error: locatePoint del árbol de 32 bits difiere demasiado.");
+
+    // Guardado y carga: la tolerancia viaja en el archivo, y no se carga con otro escalar
+    std::string path = (std::filesystem::temp_directory_path() / "bsptree_test32.bsp").string();
+    compiled32.save(path);
+    CompiledBSPTree32 loaded = CompiledBSPTree32::load(path);
+    assert(loaded.getTolerance() == compiled32.getTolerance() && loaded.memoryBytes() == compiled32.memoryBytes() &&
+           "Error: El árbol de 32 bits cargado no coincide.");
+    bool thrown = false;
+    try {
+        CompiledBSPTree::load(path);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Error: Un árbol de 32 bits no se debe cargar como uno de 64.");
+    std::filesystem::remove(path);
+
+    std::cout << "Los tests del BSP-Tree compilado de 32 bits pasaron correctamente (" << compiled32.memoryBytes() / 1024
+              << " KiB frente a " << compiled.memoryBytes() / 1024 << " KiB, " << mismatches << " colisiones distintas) :D"
+              << std::endl;
+}
+
+// Rango de posiciones de los polígonos del subárbol en el recorrido de atrás hacia adelante,
+// verificando que el lado lejano se pinte antes que el nodo y el nodo antes que el lado cercano
+std::pair<size_t, size_t> verifyPaintersOrder(const BSPNode* node, const Point3D& eye, const std::unordered_map<const Polygon*, size_t>& positions) {
+    std::pair<size_t, size_t> range = {SIZE_MAX, 0};
+    if (!node) {
+        return range;
+    }
+    bool eyeInFront = node->getPartition().distance(eye) >= 0;
+    auto farRange = verifyPaintersOrder(eyeInFront ? node->getBack() : node->getFront(), eye, positions);
+    auto nearRange = verifyPaintersOrder(eyeInFront ? node->getFront() : node->getBack(), eye, positions);
+    std::pair<size_t, size_t> nodeRange = {SIZE_MAX, 0};
+    for (const Polygon& polygon : node->getPolygons()) {
+        size_t position = positions.at(&polygon);
+        nodeRange = {std::min(nodeRange.first, position), std::max(nodeRange.second, position)};
+    }
+    for (const auto& [first, last] : {farRange, nodeRange, nearRange}) {
+        if (first == SIZE_MAX) {
+            continue;
+        }
+        assert((range.first == SIZE_MAX || range.second < first) && "Error: El recorrido no respeta el orden del pintor.");
+        range = {std::min(range.first, first), last};
+    }
+    return range;
+}
+
+void testVisibilityTraversal() {
+    BSPTree bspTree;
+
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(300, p_min, p_max, p_min, p_max, p_min, p_max);
+    for (const auto& polygon : randomPolygons) {
+        bspTree.insert(polygon);
+    }
+    size_t polygonsCount = bspTree.getRoot()->getPolygonsCount();
+
+    for (int i = 0; i < 20; ++i) {
+        Point3D eye = randomPointInBox(p_min - 5, p_max + 5, p_min - 5, p_max + 5, p_min - 5, p_max + 5);
+        std::vector<const Polygon*> backToFront, frontToBack;
+        bspTree.traverse(eye, BACK_TO_FRONT, [&](const Polygon& polygon) { backToFront.push_back(&polygon); });
+        bspTree.traverse(eye, FRONT_TO_BACK, [&](const Polygon& polygon) { frontToBack.push_back(&polygon); });
+        assert(backToFront.size() == polygonsCount && "Error: El recorrido no visitó todos los polígonos.");
+        assert(std::equal(backToFront.begin(), backToFront.end(), frontToBack.rbegin()) && "Error: Los recorridos no son inversos.");
+
+        std::unordered_map<const Polygon*, size_t> positions;
+        for (size_t j = 0; j < backToFront.size(); ++j) {
+            positions[backToFront[j]] = j;
+        }
+        verifyPaintersOrder(bspTree.getRoot(), eye, positions);
+
+        // Terminación temprana
+        size_t visited = 0;
+        bool completed = bspTree.traverse(eye, FRONT_TO_BACK, [&](const Polygon&) { return ++visited < 10; });
+        assert(!completed && visited == 10 && "Error: El recorrido no se detuvo.");
+
+        // La celda del ojo es un nodo sin hijo en su lado
+        BSPNode* cell = bspTree.getRoot()->visibilityOrder(eye);
+        BSPNode* side = cell->getPartition().inPositiveSide(eye) ? cell->getFront() : cell->getBack();
+        assert(side == nullptr && "Error: visibilityOrder no llegó a la celda del punto.");
+    }
+
+    // Dos cuadrados paralelos vistos desde arriba
+    BSPTree squares;
+    squares.insert(Polygon({Point3D(0, 0, 5), Point3D(1, 0, 5), Point3D(1, 1, 5), Point3D(0, 1, 5)}));
+    squares.insert(Polygon({Point3D(0, 0, 0), Point3D(1, 0, 0), Point3D(1, 1, 0), Point3D(0, 1, 0)}));
+    std::vector<NType> heights;
+    squares.traverse(Point3D(0.5, 0.5, 10), BACK_TO_FRONT, [&](const Polygon& polygon) { heights.push_back(polygon.getVertex(0).getZ()); });
+    assert(heights.size() == 2 && heights[0] == 0 && heights[1] == 5 && "Error: El orden de atrás hacia adelante es incorrecto.");
+
+    std::cout << "Los tests de recorrido por visibilidad pasaron correctamente :D" << std::endl;
+}
+
+// Verifica que los límites de cada nodo sean exactamente la unión de sus polígonos y los de sus hijos
+BoundingBox verifyNodeBounds(const BSPNode* node) {
+    BoundingBox expected;
+    if (!node) {
+        return expected;
+    }
+    for (const Polygon& polygon : node->getPolygons()) {
+        for (const Point3D& vertex : polygon.getVertices()) {
+            expected.extend(vertex);
+        }
+    }
+    expected.extend(verifyNodeBounds(node->getFront()));
+    expected.extend(verifyNodeBounds(node->getBack()));
+    const BoundingBox& actual = node->getBounds();
+    assert(std::equal(actual.min, actual.min + 3, expected.min) && std::equal(actual.max, actual.max + 3, expected.max) &&
+           "Error: Los límites del nodo no contienen exactamente a su subárbol.");
+    return expected;
+}
+
+// Polígonos que no están completamente detrás de alguno de los planos, sin usar el árbol
+std::vector<const Polygon*> bruteForceVolume(const BSPTree& bspTree, const std::vector<Plane>& planes) {
+    std::vector<const Polygon*> result;
+    bspTree.traverse(Point3D(0, 0, 0), BACK_TO_FRONT, [&](const Polygon& polygon) {
+        for (const Plane& plane : planes) {
+            if (polygon.relationWithPlane(plane) == BEHIND) {
+                return;
+            }
+        }
+        result.push_back(&polygon);
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void testVolumeQuery() {
+    BSPTree bspTree;
+
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(500, p_min, p_max, p_min, p_max, p_min, p_max);
+    for (size_t i = 0; i < randomPolygons.size() / 2; ++i) {
+        bspTree.insert(randomPolygons[i]);
+    }
+
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 20; ++i) {
+            // Caja con las normales hacia adentro, más un plano inclinado
+            Point3D low = randomPointInBox(p_min, p_max / 2, p_min, p_max / 2, p_min, p_max / 2);
+            Point3D high = Vector3D(low) + Vector3D(randomPointInBox(2, 10, 2, 10, 2, 10));
+            std::vector<Plane> planes = {
+                    Plane(low, Vector3D(1, 0, 0)), Plane(low, Vector3D(0, 1, 0)), Plane(low, Vector3D(0, 0, 1)),
+                    Plane(high, Vector3D(-1, 0, 0)), Plane(high, Vector3D(0, -1, 0)), Plane(high, Vector3D(0, 0, -1))
+            };
+            if (i % 2 == 1) {
+                planes.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max), randomUnitVector());
+            }
+            std::vector<const Polygon*> actual = bspTree.queryVolume(planes);
+            std::sort(actual.begin(), actual.end());
+            assert(actual == bruteForceVolume(bspTree, planes) && "Error: La consulta por volumen no coincide con la de fuerza bruta.");
+        }
+        verifyNodeBounds(bspTree.getRoot());
+        // Sin planos se devuelven todos los polígonos
+        assert(bspTree.queryVolume({}).size() == bspTree.getRoot()->getPolygonsCount() && "Error: La consulta sin planos debe devolver todo.");
+
+        // Los límites deben actualizarse al insertar más polígonos
+        for (size_t i = randomPolygons.size() / 2; i < randomPolygons.size(); ++i) {
+            bspTree.insert(randomPolygons[i]);
+        }
+    }
+
+    std::cout << "Los tests de consulta por volumen convexo pasaron correctamente :D" << std::endl;
+}
+
+// Caras de una caja con las normales hacia afuera
+std::vector<Polygon> boxPolygons(const Point3D& low, const Point3D& high) {
+    NType x0 = low.getX(), y0 = low.getY(), z0 = low.getZ();
+    NType x1 = high.getX(), y1 = high.getY(), z1 = high.getZ();
+    return {
+            Polygon({Point3D(x1, y0, z0), Point3D(x1, y1, z0), Point3D(x1, y1, z1), Point3D(x1, y0, z1)}),
+            Polygon({Point3D(x0, y0, z1), Point3D(x0, y1, z1), Point3D(x0, y1, z0), Point3D(x0, y0, z0)}),
+            Polygon({Point3D(x0, y1, z0), Point3D(x0, y1, z1), Point3D(x1, y1, z1), Point3D(x1, y1, z0)}),
+            Polygon({Point3D(x1, y0, z0), Point3D(x1, y0, z1), Point3D(x0, y0, z1), Point3D(x0, y0, z0)}),
+            Polygon({Point3D(x0, y0, z1), Point3D(x1, y0, z1), Point3D(x1, y1, z1), Point3D(x0, y1, z1)}),
+            Polygon({Point3D(x0, y1, z0), Point3D(x1, y1, z0), Point3D(x1, y0, z0), Point3D(x0, y0, z0)})
+    };
+}
+
+// Caras de un octaedro |x| + |y| + |z| <= r con las normales hacia afuera
+std::vector<Polygon> octahedronPolygons(const Point3D& center, double r) {
+    std::vector<Polygon> faces;
+    for (int sx : {-1, 1}) {
+        for (int sy : {-1, 1}) {
+            for (int sz : {-1, 1}) {
+                std::vector<Point3D> vertices = {Vector3D(center) + Vector3D(sx * r, 0, 0), Vector3D(center) + Vector3D(0, sy * r, 0),
+                                                 Vector3D(center) + Vector3D(0, 0, sz * r)};
+                if (sx * sy * sz < 0) {
+                    std::swap(vertices[1], vertices[2]);
+                }
+                faces.emplace_back(vertices);
+            }
+        }
+    }
+    return faces;
+}
+
+void testSolidClassification() {
+    // Unión de una caja y un octaedro separados: un sólido no convexo
+    std::vector<Polygon> polygons = boxPolygons(Point3D(0, 0, 0), Point3D(4, 2, 3));
+    std::vector<Polygon> octahedron = octahedronPolygons(Point3D(10, 10, 10), 3);
+    polygons.insert(polygons.end(), octahedron.begin(), octahedron.end());
+    auto expectedLocation = [](const Point3D& p) {
+        double x = p.getX().getValue(), y = p.getY().getValue(), z = p.getZ().getValue();
+        bool inBox = x > 0 && x < 4 && y > 0 && y < 2 && z > 0 && z < 3;
+        bool inOctahedron = std::abs(x - 10) + std::abs(y - 10) + std::abs(z - 10) < 3;
+        return inBox || inOctahedron ? INSIDE : OUTSIDE;
+    };
+
+    BSPTree bspTree;
+    bool thrown = false;
+    try {
+        bspTree.classifyPoint(Point3D(0, 0, 0));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Error: classifyPoint debe fallar en un árbol que no es sólido.");
+
+    bspTree.buildSolid(polygons);
+    assert(bspTree.isSolid() && "Error: El árbol debe ser sólido.");
+
+    std::vector<Point3D> points;
+    for (int i = 0; i < 20000; ++i) {
+        points.push_back(randomPointInBox(-1, 14, -1, 14, -1, 14));
+    }
+    std::vector<PointLocation> batch = bspTree.classifyPoints(points);
+    ThreadPool pool(4);
+    std::vector<PointLocation> parallel(points.size());
+    bspTree.classifyPoints(points.data(), points.size(), parallel.data(), pool);
+    size_t inside = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        PointLocation expected = expectedLocation(points[i]);
+        assert(bspTree.classifyPoint(points[i]) == expected && "Error: La clasificación del punto es incorrecta.");
+        assert(batch[i] == expected && parallel[i] == expected && "Error: La clasificación por lotes es incorrecta.");
+        assert(bspTree.getRoot()->contains(points[i]) == (expected == INSIDE) && "Error: BSPNode::contains es incorrecto.");
+        inside += expected == INSIDE;
+    }
+    assert(inside > 0 && "Error: Ningún punto quedó dentro del sólido.");
+
+    // Puntos sobre la superficie: centros de caras, aristas y vértices
+    std::vector<Point3D> boundary = {Point3D(2, 1, 3), Point3D(4, 1, 1.5), Point3D(0, 0, 0), Point3D(2, 0, 0),
+                                     Point3D(13, 10, 10), Point3D(11, 11, 11), Point3D(10, 10, 7)};
+    std::vector<PointLocation> boundaryBatch = bspTree.classifyPoints(boundary);
+    for (size_t i = 0; i < boundary.size(); ++i) {
+        assert(bspTree.classifyPoint(boundary[i]) == ON_BOUNDARY && "Error: El punto debería estar en el borde.");
+        assert(boundaryBatch[i] == ON_BOUNDARY && "Error: El punto debería estar en el borde (por lotes).");
+    }
+
+    std::cout << "Los tests de clasificación de puntos en sólidos pasaron correctamente :D" << std::endl;
+}
+
+// Vértices de los polígonos leídos por lotes, en orden
+std::vector<std::vector<Point3D>> readMeshPolygons(const std::string& path, size_t batchPolygons, size_t& batches) {
+    std::vector<std::vector<Point3D>> polygons;
+    batches = 0;
+    readMeshAsync(path, batchPolygons, [&](PolygonBatch& batch) {
+        assert(batch.size() <= batchPolygons && "Error: El lote es más grande de lo pedido.");
+        batches++;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            polygons.emplace_back(batch.getVertices(i), batch.getVertices(i) + batch.getVerticesCount(i));
+        }
+    });
+    return polygons;
+}
+
+void testMeshReaders() {
+    std::vector<Polygon> cube = boxPolygons(Point3D(0, 0, 0), Point3D(1, 2, 3));
+    auto directory = std::filesystem::temp_directory_path();
+    std::string objPath = (directory / "bsptree_test.obj").string();
+    std::string stlPath = (directory / "bsptree_test.stl").string();
+    std::string plyPath = (directory / "bsptree_test.ply").string();
+    std::string binaryPlyPath = (directory / "bsptree_test_binary.PLY").string();
+
+    // OBJ con los distintos formatos de índices, comentarios y una cara inválida
+    {
+        std::ofstream obj(objPath);
+        obj << "# cubo\no cubo\r\n";
+        for (const Polygon& face : cube) {
+            for (const Point3D& v : face.getVertices()) {
+                obj << "v " << v.getX().getValue() << " " << v.getY().getValue() << " " << v.getZ().getValue() << "\n";
+            }
+        }
+        obj << "vn 0 0 1\nf 1 2 3 4\nf 5/1 6/1 7/1 8/1\nf 9/1/1 10/1/1 11/1/1 12/1/1\nf 13//1 14//1 15//1 16//1\n";
+        obj << "v 0 0 0\nf -9 -8 -7 -6\nf 21 22 23 24\nf 1 2\n";
+    }
+    size_t batches;
+    auto objPolygons = readMeshPolygons(objPath, 4, batches);
+    assert(objPolygons.size() == cube.size() && batches == 2 && "Error: El OBJ no se leyó en lotes correctamente.");
+    for (size_t i = 0; i < cube.size(); ++i) {
+        assert(objPolygons[i].size() == 4 && "Error: La cara del OBJ no tiene cuatro vértices.");
+        for (size_t j = 0; j < 4; ++j) {
+            assert(objPolygons[i][j] == cube[i].getVertex(j) && "Error: Los vértices del OBJ son incorrectos.");
+        }
+    }
+
+    // STL binario: dos triángulos por cara
+    {
+        std::ofstream stl(stlPath, std::ios::binary);
+        char header[80] = "bsptree";
+        uint32_t triangles = 2 * cube.size();
+        stl.write(header, sizeof(header));
+        stl.write(reinterpret_cast<const char*>(&triangles), 4);
+        for (const Polygon& face : cube) {
+            for (size_t first : {size_t(1), size_t(2)}) {
+                float record[12] = {0, 0, 0};
+                size_t indices[3] = {0, first, first + 1};
+                for (size_t v = 0; v < 3; ++v) {
+                    record[3 + 3 * v] = face.getVertex(indices[v]).getX().getValue();
+                    record[4 + 3 * v] = face.getVertex(indices[v]).getY().getValue();
+                    record[5 + 3 * v] = face.getVertex(indices[v]).getZ().getValue();
+                }
+                uint16_t attributes = 0;
+                stl.write(reinterpret_cast<const char*>(record), sizeof(record));
+                stl.write(reinterpret_cast<const char*>(&attributes), 2);
+            }
+        }
+    }
+    auto stlPolygons = readMeshPolygons(stlPath, 5, batches);
+    assert(stlPolygons.size() == 12 && batches == 3 && "Error: El STL no se leyó correctamente.");
+    assert(stlPolygons[1][1] == cube[0].getVertex(2) && stlPolygons[1][2] == cube[0].getVertex(3) && "Error: Los vértices del STL son incorrectos.");
+
+    // PLY ascii y binario, con propiedades y elementos que se ignoran
+    std::vector<Point3D> plyVertices;
+    for (const Polygon& face : cube) {
+        plyVertices.insert(plyVertices.end(), face.getVertices().begin(), face.getVertices().end());
+    }
+    auto plyHeader = [&](std::ostream& out, const char* format) {
+        out << "ply\nformat " << format << " 1.0\ncomment cubo\nelement vertex " << plyVertices.size() << "\n"
+            << "property float x\nproperty uchar red\nproperty float y\nproperty double z\n"
+            << "element face " << cube.size() << "\nproperty uchar flags\nproperty list uchar int vertex_indices\n"
+            << "element edge 1\nproperty int vertex1\nproperty int vertex2\nend_header\n";
+    };
+    {
+        std::ofstream ply(plyPath, std::ios::binary);
+        plyHeader(ply, "ascii");
+        for (const Point3D& v : plyVertices) {
+            ply << v.getX().getValue() << " 255 " << v.getY().getValue() << " " << v.getZ().getValue() << "\n";
+        }
+        for (size_t i = 0; i < cube.size(); ++i) {
+            ply << "0 4 " << 4 * i << " " << 4 * i + 1 << " " << 4 * i + 2 << " " << 4 * i + 3 << "\n";
+        }
+        ply << "0 1\n";
+    }
+    {
+        std::ofstream ply(binaryPlyPath, std::ios::binary);
+        plyHeader(ply, "binary_little_endian");
+        for (const Point3D& v : plyVertices) {
+            float x = v.getX().getValue(), y = v.getY().getValue();
+            double z = v.getZ().getValue();
+            uint8_t red = 255;
+            ply.write(reinterpret_cast<const char*>(&x), 4);
+            ply.write(reinterpret_cast<const char*>(&red), 1);
+            ply.write(reinterpret_cast<const char*>(&y), 4);
+            ply.write(reinterpret_cast<const char*>(&z), 8);
+        }
+        for (size_t i = 0; i < cube.size(); ++i) {
+            uint8_t flags = 0, count = 4;
+            ply.write(reinterpret_cast<const char*>(&flags), 1);
+            ply.write(reinterpret_cast<const char*>(&count), 1);
+            for (int32_t j = 0; j < 4; ++j) {
+                int32_t index = static_cast<int32_t>(4 * i) + j;
+                ply.write(reinterpret_cast<const char*>(&index), 4);
+            }
+        }
+        int32_t edge[2] = {0, 1};
+        ply.write(reinterpret_cast<const char*>(edge), sizeof(edge));
+    }
+    for (const std::string& path : {plyPath, binaryPlyPath}) {
+        auto plyPolygons = readMeshPolygons(path, 100, batches);
+        assert(plyPolygons == objPolygons && batches == 1 && "Error: El PLY no coincide con el OBJ.");
+    }
+
+    // Del archivo al árbol, con el build de todas las caras
+    BSPTree bspTree;
+    assert(buildMesh(objPath, bspTree, balancedSplitter(), 2) == cube.size() && "Error: buildMesh no leyó todas las caras.");
+    assert(bspTree.getRoot()->getPolygonsCount() == cube.size() && "Error: El árbol no tiene todas las caras.");
+
+    // Una malla más grande: el mismo árbol que build, no el de insertar cara por cara
+    std::string randomPath = (directory / "bsptree_test_random.obj").string();
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(500, 0, 20, 0, 20, 0, 20);
+    {
+        std::ofstream obj(randomPath);
+        obj << std::setprecision(17);
+        size_t vertices = 0;
+        for (const Polygon& polygon : randomPolygons) {
+            for (const Point3D& v : polygon.getVertices()) {
+                obj << "v " << v.getX().getValue() << " " << v.getY().getValue() << " " << v.getZ().getValue() << "\n";
+            }
+            obj << "f";
+            for (size_t i = 0; i < polygon.getVertices().size(); ++i) {
+                obj << " " << ++vertices;
+            }
+            obj << "\n";
+        }
+    }
+    BSPTree meshTree, builtTree, insertedTree;
+    buildMesh(randomPath, meshTree, balancedSplitter(), 64);
+    builtTree.build(randomPolygons);
+    for (const Polygon& polygon : randomPolygons) {
+        insertedTree.insert(polygon);
+    }
+    TreeStats meshStats = meshTree.stats(), builtStats = builtTree.stats(), insertedStats = insertedTree.stats();
+    assert(meshStats.height == builtStats.height && meshStats.nodes == builtStats.nodes &&
+           meshStats.fragments == builtStats.fragments && "Error: buildMesh no da el mismo árbol que build.");
+    assert(meshStats.height < insertedStats.height && "Error: buildMesh no es más bajo que insertar cara por cara.");
+    std::filesystem::remove(randomPath);
+    std::vector<Polygon> polygons;
+    readMesh(binaryPlyPath, 64, [&](PolygonBatch& batch) {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            polygons.push_back(batch.getPolygon(i));
+        }
+    });
+    BSPTree solidTree;
+    solidTree.buildSolid(polygons);
+    assert(solidTree.classifyPoint(Point3D(0.5, 1, 1.5)) == INSIDE && solidTree.classifyPoint(Point3D(2, 1, 1.5)) == OUTSIDE &&
+           "Error: El sólido leído del PLY está mal orientado.");
+
+    // Errores del lector y del consumidor se propagan sin bloquearse
+    auto throws = [](const std::function<void()>& action) {
+        try {
+            action();
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws([&] { readMeshAsync(objPath, 1, [](PolygonBatch&) { throw std::runtime_error("consumidor"); }); }) &&
+           "Error: La excepción del consumidor no se propagó.");
+    {
+        std::ofstream obj(objPath);
+        obj << "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\nf 1 2 4\n";
+    }
+    assert(throws([&] { readMeshAsync(objPath, 1, [](PolygonBatch&) {}); }) && "Error: El índice fuera de rango no falló.");
+    assert(throws([&] { readMesh(objPath + ".txt", 1, [](PolygonBatch&) {}); }) && "Error: El formato desconocido no falló.");
+
+    for (const std::string& path : {objPath, stlPath, plyPath, binaryPlyPath}) {
+        std::filesystem::remove(path);
+    }
+
+    std::cout << "Los tests de lectura de mallas pasaron correctamente (buildMesh: altura " << meshStats.height << ", "
+              << meshStats.nodes << " nodos; cara por cara: altura " << insertedStats.height << ", " << insertedStats.nodes
+              << " nodos) :D" << std::endl;
+}
+
+void testBuildHeuristics() {
+    int n_polygons = 300;
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(n_polygons, p_min, p_max, p_min, p_max, p_min, p_max);
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < 300; ++i) {
+        segments.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                              randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+    }
+
+    std::vector<std::pair<const char*, SplitterSelector>> selectors = {
+            {"first", firstPolygonSplitter()},
+            {"balanced", balancedSplitter()},
+            {"surface area", surfaceAreaSplitter()},
+    };
+    for (const auto& [name, selector] : selectors) {
+        BSPTree bspTree;
+        BuildStats stats = bspTree.build(randomPolygons, selector);
+        assert(stats.polygons == bspTree.getRoot()->getPolygonsCount() && "Error: Las estadísticas del build no coinciden con el árbol.");
+
+        std::unordered_set<const Polygon*> verifiedPolygons;
+        assert(verifyBSPNode(bspTree.getRoot(), verifiedPolygons) && "Error: Algunos polígonos no están correctamente ubicados en el BSP-Tree.");
+
+        for (const LineSegment& segment : segments) {
+            Collision expected = bruteForceCollision(randomPolygons, segment);
+            Collision actual = bspTree.detectCollision(segment);
+            assert(bool(expected) == bool(actual) && "Error: La colisión del BSP-Tree construido no coincide con la de fuerza bruta.");
+            assert((!actual || abs(expected.distance - actual.distance) < 1e-3) && "Error: La distancia de colisión es incorrecta.");
+        }
+        std::cout << "  build " << name << ": profundidad " << stats.depth << ", nodos " << stats.nodes
+                  << ", fragmentos " << stats.polygons << ", cortes " << stats.splits << std::endl;
+    }
+
+    std::cout << "Los tests de construcción del BSP-Tree pasaron correctamente :D" << std::endl;
+}
+
+void testParallelBuild() {
+    int n_polygons = 2000;
+    int p_min = 0, p_max = 50;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(n_polygons, p_min, p_max, p_min, p_max, p_min, p_max);
+
+    BSPTree sequentialTree;
+    BuildStats sequentialStats = sequentialTree.build(randomPolygons);
+
+    // Grano pequeño para forzar muchas tareas
+    ThreadPool pool(4);
+    BSPTree parallelTree;
+    BuildStats parallelStats = parallelTree.build(randomPolygons, balancedSplitter(), pool, 64);
+    assert(parallelStats.polygons == sequentialStats.polygons && parallelStats.nodes == sequentialStats.nodes &&
+           parallelStats.splits == sequentialStats.splits && parallelStats.depth == sequentialStats.depth &&
+           "Error: El build paralelo no produce el mismo árbol que el secuencial.");
+    assert(parallelStats.polygons == parallelTree.getRoot()->getPolygonsCount() && "Error: Las estadísticas del build paralelo no coinciden con el árbol.");
+
+    std::unordered_set<const Polygon*> verifiedPolygons;
+    assert(verifyBSPNode(parallelTree.getRoot(), verifiedPolygons) && "Error: Algunos polígonos no están correctamente ubicados en el BSP-Tree.");
+    verifyNodeBounds(sequentialTree.getRoot());
+    verifyNodeBounds(parallelTree.getRoot());
+    for (int i = 0; i < 300; ++i) {
+        LineSegment segment(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                            randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+        Collision expected = sequentialTree.detectCollision(segment);
+        Collision actual = parallelTree.detectCollision(segment);
+        assert(bool(expected) == bool(actual) && "Error: La colisión del árbol paralelo no coincide.");
+    }
+
+    std::cout << "Los tests del build paralelo pasaron correctamente :D" << std::endl;
+}
+
+// Verifica el resumen de cada nodo (fragmentos, fragmentos de cortes, nodos y altura) contra su subárbol.
+// 'fragmentsById' cuenta los fragmentos de cada id en todo el árbol
+void verifyNodeSummary(const BSPNode* node, const std::unordered_map<PolygonId, size_t>& fragmentsById,
+                       size_t& fragments, size_t& splitFragments, size_t& nodes, size_t& height) {
+    fragments = splitFragments = nodes = height = 0;
+    if (!node) {
+        return;
+    }
+    size_t frontFragments, frontSplit, frontNodes, frontHeight, backFragments, backSplit, backNodes, backHeight;
+    verifyNodeSummary(node->getFront(), fragmentsById, frontFragments, frontSplit, frontNodes, frontHeight);
+    verifyNodeSummary(node->getBack(), fragmentsById, backFragments, backSplit, backNodes, backHeight);
+    fragments = node->getPolygons().size() + frontFragments + backFragments;
+    splitFragments = frontSplit + backSplit;
+    for (const Polygon& polygon : node->getPolygons()) {
+        splitFragments += fragmentsById.at(polygon.getId()) > 1 ? 1 : 0;
+    }
+    nodes = 1 + frontNodes + backNodes;
+    height = 1 + std::max(frontHeight, backHeight);
+    assert(node->getFragmentsCount() == fragments && node->getSplitFragmentsCount() == splitFragments &&
+           node->getNodesCount() == nodes && node->getHeight() == height &&
+           "Error: El resumen del nodo no coincide con su subárbol.");
+}
+
+void verifyTreeSummary(const BSPTree& bspTree) {
+    std::unordered_map<PolygonId, size_t> fragmentsById;
+    bspTree.traverse(Point3D(0, 0, 0), BACK_TO_FRONT, [&](const Polygon& polygon) { fragmentsById[polygon.getId()]++; });
+    size_t fragments, splitFragments, nodes, height;
+    verifyNodeSummary(bspTree.getRoot(), fragmentsById, fragments, splitFragments, nodes, height);
+    assert(fragmentsById.size() == bspTree.getSourcePolygonsCount() && "Error: Hay ids de polígonos sin fragmentos en el árbol.");
+}
+
+void testPolygonRemoval() {
+    int n_polygons = 400;
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(n_polygons, p_min, p_max, p_min, p_max, p_min, p_max);
+
+    // build: el polígono i recibe el id i, guardando los polígonos originales
+    BSPTree builtTree;
+    builtTree.setKeepSourcePolygons(true);
+    builtTree.build(randomPolygons);
+    builtTree.traverse(Point3D(0, 0, 0), BACK_TO_FRONT, [&](const Polygon& polygon) {
+        assert(polygon.getId() < randomPolygons.size() && "Error: Un fragmento no tiene el id de su polígono.");
+        assert(builtTree.getSourcePolygon(polygon.getId())->getVertices() == randomPolygons[polygon.getId()].getVertices() &&
+               "Error: El polígono original del id no coincide.");
+    });
+    verifyTreeSummary(builtTree);
+
+    // Sin política ni copias: insert no reconstruye y no se guardan los polígonos originales
+    BSPTree plainTree;
+    for (const auto& polygon : randomPolygons) {
+        plainTree.insert(polygon);
+    }
+    assert(plainTree.getRebuildsCount() == 0 && plainTree.getSourcePolygon(0) == nullptr &&
+           plainTree.stats().sourceBytes == 0 && "Error: Un árbol sin política no debe reconstruir ni copiar polígonos.");
+    verifyTreeSummary(plainTree);
+
+    // Política exigente para forzar reconstrucciones de subárboles
+    BSPTree bspTree;
+    bspTree.setKeepSourcePolygons(true);
+    RebuildPolicy policy;
+    policy.enabled = true;
+    policy.minPolygons = 16;
+    policy.maxDepthRatio = 1.5;
+    bspTree.setRebuildPolicy(policy);
+    std::vector<PolygonId> ids;
+    for (const auto& polygon : randomPolygons) {
+        ids.push_back(bspTree.insert(polygon));
+        assert(ids.back() != NO_POLYGON_ID && "Error: insert no devolvió un id.");
+    }
+    assert(bspTree.getRebuildsCount() > 0 && "Error: No se reconstruyó ningún subárbol degradado.");
+    verifyTreeSummary(bspTree);
+    verifyNodeBounds(bspTree.getRoot());
+
+    // Quitar la mitad de los polígonos
+    std::vector<Polygon> remaining;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i % 2 == 0) {
+            assert(bspTree.remove(ids[i]) && "Error: remove no encontró un polígono insertado.");
+            assert(!bspTree.remove(ids[i]) && "Error: remove quitó dos veces el mismo polígono.");
+        } else {
+            remaining.push_back(randomPolygons[i]);
+        }
+    }
+    assert(!bspTree.remove(NO_POLYGON_ID) && "Error: remove encontró un id inexistente.");
+    assert(bspTree.getSourcePolygonsCount() == remaining.size() && "Error: Quedan polígonos quitados en el árbol.");
+
+    size_t fragments = 0;
+    bspTree.traverse(Point3D(0, 0, 0), BACK_TO_FRONT, [&](const Polygon& polygon) {
+        assert(polygon.getId() % 2 == 1 && "Error: Quedó un fragmento de un polígono quitado.");
+        fragments++;
+    });
+    assert(bspTree.getRoot()->getPolygonsCount() == fragments && "Error: La cuenta de polígonos no se actualizó al quitar.");
+    verifyTreeSummary(bspTree);
+    verifyNodeBounds(bspTree.getRoot());
+    std::unordered_set<const Polygon*> verifiedPolygons;
+    assert(verifyBSPNode(bspTree.getRoot(), verifiedPolygons) && "Error: Algunos polígonos no están correctamente ubicados en el BSP-Tree.");
+
+    for (int i = 0; i < 300; ++i) {
+        LineSegment segment(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                            randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+        Collision expected = bruteForceCollision(remaining, segment);
+        Collision actual = bspTree.detectCollision(segment);
+        assert(bool(expected) == bool(actual) && "Error: La colisión tras quitar polígonos no coincide con la de fuerza bruta.");
+        if (actual) {
+            assert(abs(expected.distance - actual.distance) < 1e-3 && "Error: La distancia de colisión es incorrecta.");
+        }
+    }
+
+    // Sin polígonos no quedan nodos, y el árbol se puede volver a usar
+    for (size_t i = 1; i < ids.size(); i += 2) {
+        assert(bspTree.remove(ids[i]) && "Error: remove no encontró un polígono insertado.");
+    }
+    assert(bspTree.getRoot() == nullptr && "Error: Quedaron nodos vacíos en el árbol.");
+    PolygonId id = bspTree.insert(randomPolygons[0]);
+    assert(id != NO_POLYGON_ID && bspTree.getRoot()->getPolygonsCount() == 1 && "Error: No se pudo insertar tras vaciar el árbol.");
+
+    std::cout << "Los tests de eliminación de polígonos pasaron correctamente (" << bspTree.getRebuildsCount()
+              << " reconstrucciones) :D" << std::endl;
+}
+
+void testConcurrentBSPTree() {
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(600, p_min, p_max, p_min, p_max, p_min, p_max);
+    std::vector<Polygon> initial(randomPolygons.begin(), randomPolygons.begin() + 300);
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < 200; ++i) {
+        segments.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                              randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+    }
+
+    ConcurrentBSPTree tree;
+    tree.build(initial);
+    ConcurrentBSPTree::Snapshot first = tree.snapshot();
+    size_t firstCount = first.getPolygonsCount();
+    std::vector<Collision> firstHits = first.detectCollisions(segments);
+
+    // Lectores consultando mientras otro hilo inserta y quita polígonos de a uno
+    std::atomic<bool> editing(true);
+    std::atomic<size_t> snapshots(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&] {
+            while (editing.load()) {
+                ConcurrentBSPTree::Snapshot snapshot = tree.snapshot();
+                size_t visited = 0;
+                snapshot.traverse(Point3D(0, 0, 0), BACK_TO_FRONT, [&](const Polygon&) { visited++; });
+                assert(visited == snapshot.getPolygonsCount() && "Error: Una versión cambió mientras se consultaba.");
+                std::vector<Collision> hits = snapshot.detectCollisions(segments);
+                for (size_t i = 0; i < segments.size(); i += 20) {
+                    assert(hits[i].polygon == snapshot.detectCollision(segments[i]).polygon && "Error: La colisión por lotes no coincide en la versión.");
+                }
+                snapshots++;
+            }
+        });
+    }
+    std::vector<PolygonId> ids;
+    for (size_t i = initial.size(); i < randomPolygons.size(); ++i) {
+        ids.push_back(tree.insert(randomPolygons[i]));
+    }
+    // Se quitan los pares: los insertados de a uno y los del build (ids 0..299) en un solo lote
+    std::vector<Polygon> remaining;
+    std::vector<PolygonId> builtIds;
+    for (size_t i = 0; i < initial.size(); ++i) {
+        if (i % 2 == 0) {
+            builtIds.push_back(static_cast<PolygonId>(i));
+        } else {
+            remaining.push_back(initial[i]);
+        }
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i % 2 == 0) {
+            assert(tree.remove(ids[i]) && "Error: remove no encontró un polígono insertado.");
+        } else {
+            remaining.push_back(randomPolygons[initial.size() + i]);
+        }
+    }
+    assert(tree.remove(builtIds) == builtIds.size() && "Error: remove por lotes no encontró los polígonos del build.");
+    assert(!tree.remove(builtIds.front()) && "Error: remove quitó dos veces el mismo polígono.");
+    editing = false;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    assert(snapshots > 0 && "Error: Los lectores no tomaron ninguna versión.");
+
+    // La primera versión sigue intacta
+    assert(first.getPolygonsCount() == firstCount && "Error: La primera versión cambió.");
+    std::vector<Collision> againHits = first.detectCollisions(segments);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        assert(againHits[i].polygon == firstHits[i].polygon && "Error: Las colisiones de la primera versión cambiaron.");
+    }
+    first.release();
+
+    // La última versión coincide con la fuerza bruta sobre los polígonos que quedan
+    ConcurrentBSPTree::Snapshot last = tree.snapshot();
+    assert(last.getVersion() == tree.getVersion() && last.getVersion() > 1 && "Error: Las ediciones no publicaron versiones.");
+    verifyNodeBounds(last.getRoot());
+    for (const LineSegment& segment : segments) {
+        Collision expected = bruteForceCollision(remaining, segment);
+        Collision actual = last.detectCollision(segment);
+        assert(bool(expected) == bool(actual) && "Error: La colisión de la última versión no coincide con la de fuerza bruta.");
+        if (actual) {
+            assert(abs(expected.distance - actual.distance) < 1e-3 && "Error: La distancia de colisión es incorrecta.");
+        }
+    }
+    last.release();
+    assert(tree.reclaim() == 0 && "Error: Quedaron versiones sin liberar sin lectores.");
+
+    std::cout << "Los tests del BSP-Tree concurrente pasaron correctamente (" << snapshots << " versiones leídas) :D" << std::endl;
+}
+
+void testQueryExecutor() {
+    int p_min = 0, p_max = 20;
+    BSPTree bspTree;
+    bspTree.build(generateRandomPolygons(500, p_min, p_max, p_min, p_max, p_min, p_max));
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < 5000; ++i) {
+        segments.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                              randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+    }
+
+    // Grano pequeño para repartir el lote en muchos trozos
+    BSPQueryExecutor executor(bspTree, 4, 300, 1000);
+    std::vector<Collision> hits;
+    BatchReport report = executor.detectCollisions(segments, hits);
+    std::vector<Collision> expected = bspTree.detectCollisions(segments);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        assert(hits[i].polygon == expected[i].polygon && "Error: El ejecutor no coincide con detectCollisions.");
+    }
+    assert(report.queries == segments.size() && report.chunks.count == (segments.size() + 299) / 300 &&
+           "Error: El reporte del lote no cuenta las consultas y los trozos.");
+    assert(report.chunks.p50 <= report.chunks.p90 && report.chunks.p90 <= report.chunks.p99 &&
+           report.chunks.p99 <= report.chunks.max && report.chunks.max <= report.seconds &&
+           "Error: Los percentiles de latencia no están ordenados.");
+
+    // Clasificación de puntos: solo con un árbol sólido
+    std::vector<Point3D> points;
+    for (int i = 0; i < 10000; ++i) {
+        points.push_back(randomPointInBox(-1, 5, -1, 5, -1, 5));
+    }
+    std::vector<PointLocation> locations;
+    bool thrown = false;
+    try {
+        executor.classifyPoints(points, locations);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Error: El ejecutor debe fallar al clasificar con un árbol que no es sólido.");
+
+    BSPTree solidTree;
+    solidTree.buildSolid(boxPolygons(Point3D(0, 0, 0), Point3D(4, 2, 3)));
+    BSPQueryExecutor solidExecutor(solidTree, 4, 300, 1000);
+    report = solidExecutor.classifyPoints(points, locations);
+    assert(locations == solidTree.classifyPoints(points) && "Error: El ejecutor no coincide con classifyPoints.");
+    assert(report.chunks.count == 10 && "Error: El lote de puntos no se repartió en trozos.");
+
+    // Lotes desde varios hilos a la vez
+    std::vector<std::thread> submitters;
+    for (int t = 0; t < 3; ++t) {
+        submitters.emplace_back([&] {
+            std::vector<Collision> threadHits;
+            for (int i = 0; i < 5; ++i) {
+                executor.detectCollisions(segments, threadHits);
+                assert(threadHits[0].polygon == expected[0].polygon && "Error: Un lote concurrente no coincide.");
+            }
+        });
+    }
+    for (auto& submitter : submitters) {
+        submitter.join();
+    }
+    LatencyStats batches = executor.getBatchLatencies();
+    assert(executor.getBatchesCount() == 16 && batches.count == 16 && batches.p50 <= batches.max &&
+           "Error: El historial de latencias no registra los lotes.");
+
+    std::cout << "Los tests del ejecutor de consultas pasaron correctamente (p50 " << batches.p50 * 1e3
+              << " ms, p99 " << batches.p99 * 1e3 << " ms por lote) :D" << std::endl;
+}
+
+void testTreeStats() {
+    int p_min = 0, p_max = 20;
+    BSPTree bspTree;
+    TreeStats empty = bspTree.stats();
+    assert(empty.nodes == 0 && empty.depthHistogram.empty() && empty.memoryBytes() == 0 && "Error: Un árbol vacío debe tener estadísticas vacías.");
+
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(400, p_min, p_max, p_min, p_max, p_min, p_max);
+    BuildStats buildStats = bspTree.build(randomPolygons);
+    TreeStats stats = bspTree.stats();
+    size_t histogramNodes = 0;
+    for (size_t count : stats.depthHistogram) {
+        histogramNodes += count;
+    }
+    assert(stats.nodes == buildStats.nodes && stats.height == buildStats.depth && stats.fragments == buildStats.polygons &&
+           "Error: Las estadísticas del árbol no coinciden con las del build.");
+    assert(histogramNodes == stats.nodes && stats.depthHistogram.size() == stats.height && stats.depthHistogram[0] == 1 &&
+           "Error: El histograma de profundidades no cuenta todos los nodos.");
+    assert(stats.fragments == bspTree.getPolygonsCount() && stats.sourcePolygons == randomPolygons.size() &&
+           stats.splitFragments <= stats.fragments && "Error: La cuenta de fragmentos es incorrecta.");
+    assert(stats.leaves > 0 && stats.leaves <= stats.nodes && stats.averageLeafDepth <= stats.height &&
+           std::abs(stats.averagePolygonsPerNode - double(stats.fragments) / stats.nodes) < 1e-12 &&
+           "Error: Las medias del árbol son incorrectas.");
+    assert(stats.nodeBytes >= stats.nodes * sizeof(BSPNode) && stats.vertexBytes >= stats.fragments * 3 * sizeof(Point3D) &&
+           stats.sourceBytes == 0 && "Error: La memoria del árbol es incorrecta.");
+    // remove empieza a seguir los fragmentos por id
+    assert(bspTree.remove(0) && bspTree.stats().sourceBytes > 0 && bspTree.getSourcePolygonsCount() == randomPolygons.size() - 1 &&
+           "Error: remove no registró los fragmentos del árbol.");
+    bspTree.build(randomPolygons);
+
+    // Contadores de las consultas: solo con BSP_ENABLE_COUNTERS, si no quedan en cero
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < 500; ++i) {
+        segments.emplace_back(randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                              randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max));
+    }
+    resetQueryCounters();
+    for (const LineSegment& segment : segments) {
+        bspTree.detectCollision(segment);
+    }
+    QueryCounters single = threadQueryCounters();
+    resetQueryCounters();
+    bspTree.detectCoherentCollisions(segments);
+    QueryCounters packets = threadQueryCounters();
+    BSPQueryExecutor executor(bspTree, 2, 100);
+    std::vector<Collision> hits;
+    QueryCounters executorCounters = executor.detectCollisions(segments, hits).counters;
+    if (QUERY_COUNTERS_ENABLED) {
+        assert(single.queries == segments.size() && packets.queries == segments.size() &&
+               executorCounters.queries == segments.size() && "Error: Los contadores no cuentan las consultas.");
+        assert(single.nodesVisited >= single.planeTests && single.planeTests > 0 && single.polygonTests > 0 &&
+               packets.planeTests > 0 && executorCounters.nodesVisited > 0 && executorCounters.polygonTests > 0 &&
+               "Error: Los contadores no cuentan el trabajo de las consultas.");
+        std::cout << "  por consulta: " << single.perQuery(single.nodesVisited) << " nodos, "
+                  << single.perQuery(single.planeTests) << " planos, " << single.perQuery(single.polygonTests)
+                  << " polígonos" << std::endl;
+    } else {
+        assert(single.queries == 0 && packets.nodesVisited == 0 && executorCounters.planeTests == 0 &&
+               "Error: Los contadores deben quedar en cero sin BSP_ENABLE_COUNTERS.");
+    }
+
+    std::cout << "Los tests de estadísticas del BSP-Tree pasaron correctamente (" << stats.nodes << " nodos, "
+              << stats.memoryBytes() / 1024 << " KiB) :D" << std::endl;
+}
+
+// ¿El punto está lejos de las caras de las cajas (de coordenadas enteras)?
+bool awayFromIntegerFaces(const Point3D& p) {
+    for (double c : {p.getX().getValue(), p.getY().getValue(), p.getZ().getValue()}) {
+        if (std::abs(c - std::round(c)) < 1e-3) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool insideBox(const Point3D& p, const Point3D& low, const Point3D& high) {
+    return p.getX() > low.getX() && p.getX() < high.getX() && p.getY() > low.getY() && p.getY() < high.getY() &&
+           p.getZ() > low.getZ() && p.getZ() < high.getZ();
+}
+
+void testCSG() {
+    // Dos cajas que se cruzan, y una que comparte caras coplanares con la primera
+    Point3D lowA(0, 0, 0), highA(4, 4, 4), lowB(2, 1, 1), highB(6, 3, 3), lowC(2, 0, 0), highC(6, 4, 2);
+    BSPTree boxA, boxB, boxC;
+    boxA.buildSolid(boxPolygons(lowA, highA));
+    boxB.buildSolid(boxPolygons(lowB, highB));
+    boxC.buildSolid(boxPolygons(lowC, highC));
+
+    std::vector<Point3D> points;
+    while (points.size() < 5000) {
+        Point3D point = randomPointInBox(-1, 7, -1, 5, -1, 5);
+        if (awayFromIntegerFaces(point)) {
+            points.push_back(point);
+        }
+    }
+    ThreadPool pool(4);
+    for (const BSPTree* other : {&boxB, &boxC}) {
+        const Point3D& low = other == &boxB ? lowB : lowC;
+        const Point3D& high = other == &boxB ? highB : highC;
+        for (CSGOperation operation : {CSG_UNION, CSG_INTERSECTION, CSG_DIFFERENCE}) {
+            BSPTree sequential, parallel;
+            csg(operation, boxA, *other, sequential);
+            csg(operation, boxA, *other, parallel, pool);
+            assert(sequential.isSolid() && parallel.isSolid() && "Error: El resultado de la operación debe ser sólido.");
+            for (const Point3D& point : points) {
+                bool inA = insideBox(point, lowA, highA), inOther = insideBox(point, low, high);
+                bool expected = operation == CSG_UNION ? inA || inOther
+                              : operation == CSG_INTERSECTION ? inA && inOther : inA && !inOther;
+                assert(sequential.classifyPoint(point) == (expected ? INSIDE : OUTSIDE) &&
+                       "Error: La operación booleana clasifica mal un punto.");
+                assert(parallel.classifyPoint(point) == sequential.classifyPoint(point) &&
+                       "Error: La operación en paralelo no coincide con la secuencial.");
+            }
+        }
+    }
+
+    // Los operandos tienen que ser sólidos
+    BSPTree notSolid, result;
+    notSolid.build(boxPolygons(lowB, highB));
+    bool thrown = false;
+    try {
+        csg(CSG_UNION, boxA, notSolid, result);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    assert(thrown && "Error: csg debe fallar con un operando que no es sólido.");
+
+    // Unión de muchas cajas (brushes) como reducción en paralelo
+    std::vector<std::pair<Point3D, Point3D>> brushes;
+    std::vector<BSPTree> brushTrees(9);
+    std::vector<const BSPTree*> brushPointers;
+    std::uniform_int_distribution<int> corner(0, 7), side(1, 3);
+    for (auto& brushTree : brushTrees) {
+        Point3D low(corner(gen), corner(gen), corner(gen));
+        Point3D high(low.getX() + side(gen), low.getY() + side(gen), low.getZ() + side(gen));
+        brushes.emplace_back(low, high);
+        brushTree.buildSolid(boxPolygons(low, high));
+        brushPointers.push_back(&brushTree);
+    }
+    BSPTree merged;
+    csgUnion(brushPointers, merged, pool);
+    size_t inside = 0;
+    for (int i = 0; i < 5000; ++i) {
+        Point3D point = randomPointInBox(-1, 12, -1, 12, -1, 12);
+        if (!awayFromIntegerFaces(point)) {
+            continue;
+        }
+        bool expected = std::any_of(brushes.begin(), brushes.end(), [&](const auto& brush) {
+            return insideBox(point, brush.first, brush.second);
+        });
+        assert(merged.classifyPoint(point) == (expected ? INSIDE : OUTSIDE) && "Error: La unión de cajas clasifica mal un punto.");
+        inside += expected;
+    }
+    assert(inside > 0 && "Error: Ningún punto quedó dentro de la unión.");
+
+    std::cout << "Los tests de operaciones booleanas (CSG) pasaron correctamente (" << merged.getPolygonsCount()
+              << " polígonos en la unión) :D" << std::endl;
+}
+
+// Distancia del centro de la esfera al polígono más cercano
+double distanceToPolygons(const std::vector<Polygon>& polygons, const Point3D& center) {
+    double nearest = std::numeric_limits<double>::infinity();
+    for (const Polygon& polygon : polygons) {
+        nearest = std::min(nearest, center.distance(polygon.closestPoint(center)).getValue());
+    }
+    return nearest;
+}
+
+Point3D sweepCenter(const SphereSweep& sweep, double t) {
+    return Vector3D(sweep.start) + Vector3D(sweep.end - sweep.start) * t;
+}
+
+void testSphereSweep() {
+    // Un suelo en z = 0: la esfera de radio 1 que cae lo toca cuando su centro llega a z = 1
+    BSPTree floor;
+    floor.build({Polygon({Point3D(0, 0, 0), Point3D(4, 0, 0), Point3D(4, 4, 0), Point3D(0, 4, 0)})});
+    SweepHit hit = floor.sweepSphere({Point3D(2, 2, 5), Point3D(2, 2, -5), 1});
+    assert(hit && std::abs(hit.time.getValue() - 0.4) < 1e-9 && hit.point == Point3D(2, 2, 0) &&
+           hit.normal == Vector3D(0, 0, 1) && "Error: La esfera debe tocar la cara del suelo.");
+
+    // Contra el borde x = 0 del suelo: contacto cuando el centro está a distancia 1 de la arista
+    hit = floor.sweepSphere({Point3D(-3, 2, 0.5), Point3D(1, 2, 0.5), 1});
+    double contactX = -std::sqrt(0.75);
+    assert(hit && std::abs(hit.time.getValue() - (contactX + 3) / 4) < 1e-9 && hit.point == Point3D(0, 2, 0) &&
+           hit.normal == Vector3D(contactX, 0, 0.5) && "Error: La esfera debe tocar el borde del suelo.");
+
+    // Apoyada en el suelo puede deslizarse o alejarse, pero no hundirse
+    assert(!floor.sweepSphere({Point3D(1, 1, 1), Point3D(3, 3, 1), 1}) && "Error: Una esfera que se desliza no choca.");
+    assert(!floor.sweepSphere({Point3D(1, 1, 1), Point3D(1, 1, 3), 1}) && "Error: Una esfera que se aleja no choca.");
+    hit = floor.sweepSphere({Point3D(1, 1, 1), Point3D(1, 1, 0), 1});
+    assert(hit && hit.time == 0 && "Error: Una esfera apoyada que se hunde choca al inicio.");
+    assert(!floor.sweepSphere({Point3D(6, 6, 1), Point3D(9, 9, -1), 1}) && "Error: La esfera pasa lejos del suelo.");
+
+    // Escena aleatoria: el árbol contra la fuerza bruta (un árbol por polígono)
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> polygons = generateRandomPolygons(150, p_min, p_max, p_min, p_max, p_min, p_max);
+    BSPTree bspTree;
+    bspTree.build(polygons);
+    std::vector<BSPTree> singles(polygons.size());
+    for (size_t i = 0; i < polygons.size(); ++i) {
+        singles[i].build({polygons[i]});
+    }
+    std::vector<SphereSweep> sweeps;
+    for (int i = 0; i < 300; ++i) {
+        sweeps.push_back({randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max),
+                          randomPointInBox(p_min, p_max, p_min, p_max, p_min, p_max), randomInRange(0.1f, 1.5f)});
+    }
+    size_t hitsCount = 0;
+    for (const SphereSweep& sweep : sweeps) {
+        SweepHit treeHit = bspTree.sweepSphere(sweep);
+        double bruteTime = 2;
+        for (const BSPTree& single : singles) {
+            SweepHit singleHit = single.sweepSphere(sweep);
+            if (singleHit) {
+                bruteTime = std::min(bruteTime, singleHit.time.getValue());
+            }
+        }
+        // al partir polígonos el árbol descarta astillas de área despreciable: el primer contacto
+        // puede llegar un poco más tarde, nunca antes
+        double tolerance = 1e-2 / sweep.start.distance(sweep.end).getValue();
+        double time = treeHit ? treeHit.time.getValue() : 2, radius = sweep.radius.getValue();
+        assert(time >= bruteTime - 1e-9 && std::min(time, 1.0) <= bruteTime + tolerance &&
+               "Error: El árbol y la fuerza bruta no coinciden en el primer choque.");
+        if (!treeHit) {
+            continue;
+        }
+        hitsCount++;
+        // un choque al inicio es con un polígono que ya tocaba
+        Point3D center = sweepCenter(sweep, time);
+        if (time == 0) {
+            assert(center.distance(treeHit.point) <= radius && "Error: Un choque al inicio debe tocar el polígono.");
+            continue;
+        }
+        // si no, en el contacto toca el polígono, con la normal desde el punto hacia el centro
+        assert(std::abs(center.distance(treeHit.polygon->closestPoint(center)).getValue() - radius) < 1e-6 &&
+               std::abs(center.distance(treeHit.point).getValue() - radius) < 1e-6 &&
+               Vector3D(treeHit.point) + treeHit.normal * radius == center &&
+               "Error: El punto o la normal de contacto son incorrectos.");
+        // y antes del primer contacto con los polígonos enteros no tocaba nada, si empezó libre
+        if (distanceToPolygons(polygons, sweep.start) > radius) {
+            for (int step = 0; step < 20; ++step) {
+                assert(distanceToPolygons(polygons, sweepCenter(sweep, bruteTime * step / 20)) > radius - 1e-6 &&
+                       "Error: La esfera tocaba un polígono antes del impacto.");
+            }
+        }
+    }
+    assert(hitsCount > 0 && "Error: Ningún barrido chocó.");
+
+    // Por lotes, con el pool y con el ejecutor: lo mismo que uno a uno
+    ThreadPool pool(4);
+    std::vector<SweepHit> batch = bspTree.sweepSpheres(sweeps), parallel(sweeps.size()), executorHits;
+    bspTree.sweepSpheres(sweeps.data(), sweeps.size(), parallel.data(), pool);
+    BSPQueryExecutor executor(bspTree, 4, 50);
+    executor.sweepSpheres(sweeps, executorHits);
+    for (size_t i = 0; i < sweeps.size(); ++i) {
+        const Polygon* expected = bspTree.sweepSphere(sweeps[i]).polygon;
+        assert(batch[i].polygon == expected && parallel[i].polygon == expected && executorHits[i].polygon == expected &&
+               "Error: Los barridos por lotes no coinciden.");
+    }
+
+    std::cout << "Los tests de barrido de esferas pasaron correctamente (" << hitsCount << " de " << sweeps.size()
+              << " chocan) :D" << std::endl;
+}
+
+void testNearestPolygon() {
+    // Dos cuadrados paralelos: el punto entre ambos está más cerca del de abajo
+    BSPTree squares;
+    squares.build({Polygon({Point3D(0, 0, 0), Point3D(4, 0, 0), Point3D(4, 4, 0), Point3D(0, 4, 0)}),
+                   Polygon({Point3D(0, 0, 3), Point3D(4, 0, 3), Point3D(4, 4, 3), Point3D(0, 4, 3)})});
+    NearestPolygon nearest = squares.nearestPolygon(Point3D(1, 1, 1));
+    assert(nearest && nearest.polygon->getVertex(0).getZ() == 0 && nearest.distance == 1 && nearest.point == Point3D(1, 1, 0) &&
+           "Error: El polígono más cercano debe ser el de abajo.");
+    // fuera de los cuadrados el más cercano es un borde
+    nearest = squares.nearestPolygon(Point3D(7, 2, 0.5));
+    assert(nearest && nearest.distance == std::sqrt(9.25) && nearest.point == Point3D(4, 2, 0) &&
+           "Error: El punto más cercano debe estar en el borde.");
+    assert(!squares.nearestPolygon(Point3D(1, 1, 1), 0.5) && "Error: Ningún polígono está a menos de la distancia máxima.");
+    assert(squares.polygonsWithinRadius(Point3D(1, 1, 1), 1.5).size() == 1 &&
+           squares.polygonsWithinRadius(Point3D(1, 1, 1), 2.5).size() == 2 && "Error: La búsqueda por radio es incorrecta.");
+    assert(!BSPTree().nearestPolygon(Point3D(0, 0, 0)) && "Error: Un árbol vacío no tiene polígonos cercanos.");
+
+    // Escena aleatoria contra la fuerza bruta sobre los fragmentos del árbol
+    int p_min = 0, p_max = 20;
+    BSPTree bspTree;
+    bspTree.build(generateRandomPolygons(400, p_min, p_max, p_min, p_max, p_min, p_max));
+    std::vector<const Polygon*> fragments;
+    bspTree.getRoot()->collectPolygons(fragments);
+    resetQueryCounters();
+    for (int i = 0; i < 300; ++i) {
+        Point3D point = randomPointInBox(p_min - 5, p_max + 5, p_min - 5, p_max + 5, p_min - 5, p_max + 5);
+        double bruteDistance = std::numeric_limits<double>::infinity();
+        for (const Polygon* fragment : fragments) {
+            bruteDistance = std::min(bruteDistance, point.distance(fragment->closestPoint(point)).getValue());
+        }
+        nearest = bspTree.nearestPolygon(point);
+        assert(nearest && std::abs(nearest.distance.getValue() - bruteDistance) < 1e-9 &&
+               std::abs(point.distance(nearest.point).getValue() - bruteDistance) < 1e-9 &&
+               "Error: El polígono más cercano no coincide con la fuerza bruta.");
+        assert(!bspTree.nearestPolygon(point, bruteDistance * 0.99) &&
+               bspTree.nearestPolygon(point, bruteDistance * 1.01).polygon == nearest.polygon &&
+               "Error: La distancia máxima no se respeta.");
+
+        double radius = randomInRange(0.5, 4).getValue();
+        std::vector<const Polygon*> within = bspTree.polygonsWithinRadius(point, radius), expected;
+        for (const Polygon* fragment : fragments) {
+            if (point.distance(fragment->closestPoint(point)) <= radius) {
+                expected.push_back(fragment);
+            }
+        }
+        std::sort(within.begin(), within.end());
+        std::sort(expected.begin(), expected.end());
+        assert(within == expected && "Error: La búsqueda por radio no coincide con la fuerza bruta.");
+    }
+    if (QUERY_COUNTERS_ENABLED) {
+        QueryCounters counters = threadQueryCounters();
+        assert(counters.perQuery(counters.polygonTests) < fragments.size() / 2 &&
+               "Error: Las búsquedas deben descartar la mayoría de los polígonos.");
+    }
+
+    std::cout << "Los tests de búsqueda del polígono más cercano pasaron correctamente :D" << std::endl;
+}
+
+// Relación por vértice con Safe<double>, como antes de los kernels vectorizados
+RelationType scalarRelationWithPlane(const Polygon& polygon, const Plane& plane) {
+    size_t posCnt = 0, negCnt = 0;
+    for (const Point3D& vertex : polygon.getVertices()) {
+        auto normalProduct = plane.getNormal().dotProduct(vertex - plane.getPoint());
+        posCnt += normalProduct > 0;
+        negCnt += normalProduct < 0;
+    }
+    return posCnt == 0 && negCnt == 0 ? COINCIDENT : negCnt == 0 ? IN_FRONT : posCnt == 0 ? BEHIND : SPLIT;
+}
+
+void testPlaneEquation() {
+    // Plano z = 5 con una normal sin normalizar, que no pasa por el origen
+    Plane plane(Point3D(1, 2, 5), Vector3D(0, 0, 4));
+    assert(plane.getNormal() == Vector3D(0, 0, 1) && "Error: La normal del plano no está normalizada.");
+    assert(plane.getOffset() == -5 && "Error: El desplazamiento del plano es incorrecto.");
+    assert(plane.distance(Point3D(7, -3, 8)) == 3 && "Error: La distancia al plano es incorrecta.");
+    assert(plane.distance(Point3D(0, 0, 0)) == -5 && "Error: La distancia al plano es incorrecta.");
+    assert(!plane.inPositiveSide(Point3D(0, 0, 1)) && "Error: inPositiveSide ignora el punto del plano.");
+    assert(plane.inPositiveSide(Point3D(0, 0, 6)) && "Error: inPositiveSide es incorrecto.");
+    assert(plane.contains(Point3D(-4, 9, 5)) && "Error: El plano debería contener el punto.");
+    assert(!plane.contains(Point3D(-4, 9, 5.1)) && "Error: El plano no debería contener el punto.");
+    assert(plane.contains(Line(Point3D(0, 0, 5), Point3D(1, 1, 5))) && "Error: El plano debería contener la recta.");
+    assert(!plane.contains(Line(Point3D(0, 0, 5), Point3D(1, 1, 6))) && "Error: El plano no debería contener la recta.");
+    assert(plane.intersect(Line(Point3D(1, 1, 0), Point3D(3, 3, 2))) == Point3D(6, 6, 5) && "Error: La intersección es incorrecta.");
+
+    plane.setPoint(Point3D(0, 0, -1));
+    assert(plane.distance(Point3D(0, 0, 0)) == 1 && "Error: El plano no se actualizó al cambiar su punto.");
+    plane.setNormal(Vector3D(0, -2, 0));
+    assert(plane.distance(Point3D(0, 3, 0)) == -3 && "Error: El plano no se actualizó al cambiar su normal.");
+
+    std::cout << "Los tests de la ecuación del plano pasaron correctamente :D" << std::endl;
+}
+
+void testClassificationKernels() {
+    int p_min = 0, p_max = 20;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(500, p_min, p_max, p_min, p_max, p_min, p_max);
+
+    // Pool de vértices con todos los polígonos
+    std::vector<Point3D> pool;
+    std::vector<uint32_t> offsets = {0};
+    for (const auto& polygon : randomPolygons) {
+        pool.insert(pool.end(), polygon.getVertices().begin(), polygon.getVertices().end());
+        offsets.push_back(static_cast<uint32_t>(pool.size()));
+    }
+
+    for (int i = 0; i < 20; ++i) {
+        Plane plane = randomPolygons[i].getPlane();
+        const double* equation = plane.getEquation();
+        std::vector<RelationType> relations(randomPolygons.size());
+        classifyPolygons(vertexData(pool.data()), offsets.data(), randomPolygons.size(), equation, CLASSIFY_EPSILON, relations.data());
+        for (size_t j = 0; j < randomPolygons.size(); ++j) {
+            RelationType expected = scalarRelationWithPlane(randomPolygons[j], plane);
+            assert(randomPolygons[j].relationWithPlane(plane) == expected && "Error: relationWithPlane no coincide con la versión escalar.");
+            assert(relations[j] == expected && "Error: classifyPolygons no coincide con la versión escalar.");
+        }
+        // Las máscaras por vértice deben coincidir con el signo de la distancia
+        std::vector<uint64_t> frontMask((pool.size() + 63) / 64), backMask((pool.size() + 63) / 64);
+        classifyVertices(vertexData(pool.data()), pool.size(), equation, CLASSIFY_EPSILON, frontMask.data(), backMask.data());
+        for (size_t j = 0; j < pool.size(); ++j) {
+            auto distance = plane.getNormal().dotProduct(pool[j] - plane.getPoint());
+            assert(bool((frontMask[j / 64] >> (j % 64)) & 1) == (distance > 0) && "Error: La máscara frontal es incorrecta.");
+            assert(bool((backMask[j / 64] >> (j % 64)) & 1) == (distance < 0) && "Error: La máscara trasera es incorrecta.");
+        }
+    }
+
+    std::cout << "Los tests de los kernels de clasificación (" << classificationKernel() << ") pasaron correctamente :D" << std::endl;
+}
+
+// Cuenta las reservas que llegan al recurso de memoria
+class CountingResource : public std::pmr::memory_resource {
+public:
+    size_t allocations = 0;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        allocations++;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+void testPolygonSplit() {
+    int p_min = 0, p_max = 10;
+    std::vector<Polygon> randomPolygons = generateRandomPolygons(300, p_min, p_max, p_min, p_max, p_min, p_max);
+    // Un cuadrilátero, además de los triángulos aleatorios
+    randomPolygons.emplace_back(std::vector<Point3D>{Point3D(3, 3, 5), Point3D(7, 3, 5), Point3D(7, 7, 5), Point3D(3, 7, 5)});
+
+    SplitBuffer parts;
+    int splits = 0;
+    for (size_t i = 0; i < randomPolygons.size(); ++i) {
+        const Polygon& polygon = randomPolygons[i];
+        for (size_t j = 0; j < 20; ++j) {
+            Plane plane = randomPolygons[(i + j + 1) % randomPolygons.size()].getPlane();
+            if (polygon.relationWithPlane(plane) != SPLIT) {
+                continue;
+            }
+            splits++;
+            parts.split(polygon, plane);
+            auto frontRelation = parts.front.relationWithPlane(plane);
+            auto backRelation = parts.back.relationWithPlane(plane);
+            assert((frontRelation == IN_FRONT || frontRelation == COINCIDENT) && "Error: La parte frontal del split cruza el plano.");
+            assert((backRelation == BEHIND || backRelation == COINCIDENT) && "Error: La parte trasera del split cruza el plano.");
+            assert(std::abs((parts.front.area() + parts.back.area() - polygon.area()).getValue()) < 1e-6 && "Error: Las áreas de las partes no suman el área original.");
+
+            // Sin memoria dinámica: las partes deben caber en un buffer fijo
+            std::byte buffer[2 * 8 * sizeof(Point3D)];
+            std::pmr::monotonic_buffer_resource fixed(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+            Polygon front(&fixed), back(&fixed);
+            polygon.split(plane, front, back);
+            assert(front.getVertices().size() == parts.front.getVertices().size() && "Error: El split en el buffer fijo es distinto.");
+            assert(back.getVertices().size() == parts.back.getVertices().size() && "Error: El split en el buffer fijo es distinto.");
+        }
+    }
+    assert(splits > 0 && "Error: Ningún polígono fue dividido.");
+
+    // Muchos splits seguidos con el mismo buffer: triángulos, cuadriláteros y octógonos no deben
+    // pedir memoria al recurso de fuera, el buffer vuelve a empezar en cada split
+    std::vector<Polygon> octagon{Polygon(std::vector<Point3D>{
+            Point3D(4, 2, 1), Point3D(6, 2, 1), Point3D(8, 4, 1), Point3D(8, 6, 1),
+            Point3D(6, 8, 1), Point3D(4, 8, 1), Point3D(2, 6, 1), Point3D(2, 4, 1)})};
+    CountingResource counting;
+    SplitBuffer reused(&counting);
+    int reusedSplits = 0;
+    for (int round = 0; round < 10; ++round) {
+        for (const auto &polygons: {randomPolygons, octagon}) {
+            for (size_t i = 0; i < polygons.size(); ++i) {
+                Plane plane = randomPolygons[(i + round + 1) % randomPolygons.size()].getPlane();
+                if (polygons[i].relationWithPlane(plane) != SPLIT) {
+                    continue;
+                }
+                reusedSplits++;
+                reused.split(polygons[i], plane);
+                assert(reused.front.getVertices().size() + reused.back.getVertices().size() <= polygons[i].getVertices().size() + 4 && "Error: Las partes del split tienen demasiados vértices.");
+            }
+        }
+    }
+    assert(reusedSplits > 0 && "Error: Ningún polígono fue dividido con el buffer reutilizado.");
+    assert(counting.allocations == 0 && "Error: Los splits con SplitBuffer reservaron memoria dinámica.");
+
+    std::cout << "Los tests de split de polígonos pasaron correctamente :D" << std::endl;
+}
+
 int main() {
     testBSPTree();
+    testPlaneEquation();
+    testClassificationKernels();
+    testPolygonSplit();
+    testCollisionDetection();
+    testCompiledBSPTree();
+    testCompiledBSPTreeFile();
+    testCompiledBSPTree32();
+    testVisibilityTraversal();
+    testVolumeQuery();
+    testSolidClassification();
+    testMeshReaders();
+    testBuildHeuristics();
+    testParallelBuild();
+    testPolygonRemoval();
+    testConcurrentBSPTree();
+    testQueryExecutor();
+    testTreeStats();
+    testCSG();
+    testSphereSweep();
+    testNearestPolygon();
     return 0;
 }